@@ -0,0 +1,227 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file batchsampling.hpp
+    \brief Stratified and moment-matched sampling in batches of paths
+*/
+
+#ifndef batch_sampling_hpp
+#define batch_sampling_hpp
+
+#include "samplecontrol.hpp"
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathgenerator.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/methods/montecarlo/sample.hpp>
+#include <ql/stochasticprocess.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace QuantLib {
+
+    //! sampling scheme for the Gaussian sequences of a simulation
+    /*! With \c Stratified sampling, the leading dimension of each
+        batch of sequences is drawn from as many equiprobable strata
+        as the sequences in the batch, one per stratum.  With
+        \c MomentMatched sampling, each dimension of a batch is
+        shifted and rescaled so that its sample mean and variance are
+        exactly 0 and 1.
+    */
+    struct SamplingScheme {
+        enum Type { Plain, Stratified, MomentMatched };
+        SamplingScheme() : type(Plain), batchSize(1) {}
+        SamplingScheme(Type type, Size batchSize)
+        : type(type), batchSize(batchSize) {
+            QL_REQUIRE(type == Plain || batchSize > 1,
+                       "at least two sequences per batch required");
+        }
+        bool active() const { return type != Plain; }
+        Type type;
+        Size batchSize;
+    };
+
+
+    //! Gaussian sequence generator sampling in batches
+    /*! It draws a batch of sequences from the underlying generator,
+        transforms them according to the given scheme and returns them
+        one at a time.  It can be used in a PathGenerator; antithetic
+        paths are built as usual from the last returned sequence.
+
+        The sequences in a batch are no longer independent; the
+        estimates must average the samples over whole batches (see
+        BatchSampledSimulation.)
+    */
+    template <class RSG>
+    class BatchSampledRsg {
+      public:
+        typedef Sample<std::vector<Real> > sample_type;
+        BatchSampledRsg(RSG generator, const SamplingScheme& scheme);
+        const sample_type& nextSequence() const;
+        const sample_type& lastSequence() const {
+            return batch_[position_-1];
+        }
+        Size dimension() const { return generator_.dimension(); }
+      private:
+        void fillBatch() const;
+        mutable RSG generator_;
+        SamplingScheme scheme_;
+        CumulativeNormalDistribution cumulative_;
+        InverseCumulativeNormal inverseCumulative_;
+        mutable std::vector<sample_type> batch_;
+        mutable Size position_;
+    };
+
+
+    //! Monte Carlo simulation with batch sampling
+    /*! Paths are generated from a BatchSampledRsg; the mean of the
+        values over each batch (averaged over antithetic pairs, if
+        required) is added to the accumulator as a single sample, so
+        that its error estimate accounts for the dependence between
+        the paths in a batch.  The number of paths is rounded up to
+        whole batches and is driven by simulateToTarget().
+
+        With stratified sampling, the paths are built with a Brownian
+        bridge, so that the stratified dimension drives the terminal
+        value of the underlying.
+    */
+    template <class RNG, class S>
+    class BatchSampledSimulation {
+      public:
+        typedef BatchSampledRsg<typename RNG::rsg_type> rsg_type;
+        typedef PathGenerator<rsg_type> path_generator_type;
+        BatchSampledSimulation(
+                           const ext::shared_ptr<StochasticProcess1D>& process,
+                           const TimeGrid& grid,
+                           ext::shared_ptr<PathPricer<Path> > pricer,
+                           bool brownianBridge,
+                           bool antitheticVariate,
+                           const SamplingScheme& scheme,
+                           BigNatural seed);
+        void calculate(Real requiredTolerance,
+                       Size requiredSamples,
+                       Size maxSamples);
+        void addSamples(Size samples);
+        //! the number of simulated paths (not counting antithetic ones)
+        Size samples() const {
+            return accumulator_.samples() * scheme_.batchSize;
+        }
+        Real errorEstimate() const { return accumulator_.errorEstimate(); }
+        //! the accumulator of the batch means
+        const S& sampleAccumulator() const { return accumulator_; }
+      private:
+        path_generator_type generator_;
+        ext::shared_ptr<PathPricer<Path> > pricer_;
+        bool antitheticVariate_;
+        SamplingScheme scheme_;
+        S accumulator_;
+    };
+
+
+    // inline definitions
+
+    template <class RSG>
+    inline BatchSampledRsg<RSG>::BatchSampledRsg(RSG generator,
+                                                 const SamplingScheme& scheme)
+    : generator_(std::move(generator)), scheme_(scheme),
+      batch_(scheme.batchSize,
+             sample_type(std::vector<Real>(generator_.dimension()), 1.0)),
+      position_(scheme.batchSize) {}
+
+    template <class RSG>
+    inline const typename BatchSampledRsg<RSG>::sample_type&
+    BatchSampledRsg<RSG>::nextSequence() const {
+        if (position_ == batch_.size())
+            fillBatch();
+        return batch_[position_++];
+    }
+
+    template <class RSG>
+    inline void BatchSampledRsg<RSG>::fillBatch() const {
+        Size n = batch_.size(), dimension = generator_.dimension();
+        for (Size i=0; i<n; i++) {
+            const sample_type& sequence = generator_.nextSequence();
+            std::copy(sequence.value.begin(), sequence.value.end(),
+                      batch_[i].value.begin());
+            batch_[i].weight = sequence.weight;
+        }
+
+        if (scheme_.type == SamplingScheme::Stratified) {
+            // the i-th sequence is moved to the i-th stratum, keeping
+            // its relative position inside it
+            for (Size i=0; i<n; i++) {
+                Real u = std::min<Real>(cumulative_(batch_[i].value[0]),
+                                        1.0 - QL_EPSILON);
+                batch_[i].value[0] = inverseCumulative_((i + u)/n);
+            }
+        } else if (scheme_.type == SamplingScheme::MomentMatched) {
+            for (Size j=0; j<dimension; j++) {
+                Real mean = 0.0;
+                for (Size i=0; i<n; i++)
+                    mean += batch_[i].value[j];
+                mean /= n;
+                Real variance = 0.0;
+                for (Size i=0; i<n; i++) {
+                    Real d = batch_[i].value[j] - mean;
+                    variance += d*d;
+                }
+                Real scale = variance > 0.0 ? std::sqrt((n-1.0)/variance)
+                                            : 1.0;
+                for (Size i=0; i<n; i++)
+                    batch_[i].value[j] = (batch_[i].value[j] - mean)*scale;
+            }
+        }
+
+        position_ = 0;
+    }
+
+
+    template <class RNG, class S>
+    inline BatchSampledSimulation<RNG,S>::BatchSampledSimulation(
+                           const ext::shared_ptr<StochasticProcess1D>& process,
+                           const TimeGrid& grid,
+                           ext::shared_ptr<PathPricer<Path> > pricer,
+                           bool brownianBridge,
+                           bool antitheticVariate,
+                           const SamplingScheme& scheme,
+                           BigNatural seed)
+    : generator_(process, grid,
+                 rsg_type(RNG::make_sequence_generator(grid.size()-1, seed),
+                          scheme),
+                 brownianBridge || scheme.type == SamplingScheme::Stratified),
+      pricer_(std::move(pricer)), antitheticVariate_(antitheticVariate),
+      scheme_(scheme) {
+        QL_REQUIRE(scheme.active(), "no sampling scheme given");
+    }
+
+    template <class RNG, class S>
+    inline void BatchSampledSimulation<RNG,S>::calculate(
+                                                     Real requiredTolerance,
+                                                     Size requiredSamples,
+                                                     Size maxSamples) {
+        simulateToTarget(*this, requiredTolerance, requiredSamples,
+                         maxSamples);
+    }
+
+    template <class RNG, class S>
+    inline void BatchSampledSimulation<RNG,S>::addSamples(Size samples) {
+        Size n = scheme_.batchSize;
+        Size batches = (samples + n - 1) / n;
+        for (Size k=0; k<batches; k++) {
+            Real sum = 0.0;
+            for (Size i=0; i<n; i++) {
+                Real value = (*pricer_)(generator_.next().value);
+                if (antitheticVariate_)
+                    value = (value +
+                             (*pricer_)(generator_.antithetic().value))/2.0;
+                sum += value;
+            }
+            accumulator_.add(sum/n, 1.0);
+        }
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,1968 @@
+
+#include <ql/qldefines.hpp>
+#ifdef BOOST_MSVC
+#  include <ql/auto_link.hpp>
+#endif
+#include "compensatedstatistics.hpp"
+#include "constantblackscholesprocess.hpp"
+#include "marketupdate.hpp"
+#include "mccheckpoint.hpp"
+#include "mc_discr_arith_av_strike.hpp"
+#include "mcbarrierengine.hpp"
+#include "mceuropeanengine.hpp"
+#include "shardlauncher.hpp"
+#include <ql/instruments/asianoption.hpp>
+#include <ql/instruments/barrieroption.hpp>
+#include <ql/instruments/europeanoption.hpp>
+#include <ql/instruments/payoffs.hpp>
+#include <ql/exercise.hpp>
+#include <ql/pricingengines/blackformula.hpp>
+#include <ql/pricingengines/vanilla/mceuropeanengine.hpp>
+#include <ql/pricingengines/barrier/mcbarrierengine.hpp>
+#include <ql/termstructures/yield/flatforward.hpp>
+#include <ql/termstructures/yield/zerocurve.hpp>
+#include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
+#include <ql/termstructures/volatility/equityfx/blackvariancecurve.hpp>
+#include <ql/time/calendars/target.hpp>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include <string>
+
+using namespace QuantLib;
+
+namespace {
+
+    Size width = 15;
+
+    // the same market data used in main.cpp
+    ext::shared_ptr<GeneralizedBlackScholesProcess> makeProcess(
+                                    const Date& today,
+                                    const ext::shared_ptr<SimpleQuote>& spot,
+                                    const std::vector<Rate>& rates = {0.01, 0.015},
+                                    const std::vector<Volatility>& vols = {0.20, 0.25}) {
+        Handle<Quote> underlyingH(spot);
+
+        DayCounter dayCounter = Actual365Fixed();
+        Handle<YieldTermStructure> riskFreeRate(
+            ext::make_shared<ZeroCurve>(std::vector<Date>{today, today + 6*Months},
+                                        rates,
+                                        dayCounter));
+        Handle<BlackVolTermStructure> volatility(
+            ext::make_shared<BlackVarianceCurve>(today,
+                                                 std::vector<Date>{today+3*Months, today+6*Months},
+                                                 vols,
+                                                 dayCounter));
+
+        return ext::make_shared<BlackScholesProcess>(underlyingH, riskFreeRate, volatility);
+    }
+
+    ext::shared_ptr<GeneralizedBlackScholesProcess> makeProcess(
+                                                       const Date& today) {
+        return makeProcess(today, ext::make_shared<SimpleQuote>(36.0));
+    }
+
+    // prices the instrument and returns the elapsed time in seconds
+    double timedNPV(const Instrument& instrument, Real& NPV) {
+        auto startTime = std::chrono::steady_clock::now();
+        NPV = instrument.NPV();
+        auto endTime = std::chrono::steady_clock::now();
+        double us = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+        return us / 1000000;
+    }
+
+
+    // full paths vs. lazy paths stopped at the barrier
+
+    void earlyTermination(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                          const Date& maturity) {
+
+        Size samples = 200000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Early termination of barrier paths (constant parameters, "
+                  << samples << " samples)" << std::endl;
+        std::cout << std::setw(45) << "full paths"
+                  << std::setw(45) << "early termination"
+                  << std::endl;
+        std::cout << spacer << "kind" << spacer << "steps"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "steps/path"
+                  << std::endl;
+
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+
+        struct { Barrier::Type type; Real barrier; } cases[] = {
+            { Barrier::UpOut, 40 }, { Barrier::DownOut, 33 },
+            { Barrier::UpIn, 40 }, { Barrier::DownIn, 33 }
+        };
+
+        for (auto c : cases) {
+            for (Size timeSteps : std::vector<Size>{10, 100}) {
+                BarrierOption barrierOption(c.type, c.barrier, 0, payoff, exercise);
+
+                barrierOption.setPricingEngine(
+                    MakeMCBarrierEngine_2<PseudoRandom>(process)
+                    .withSteps(timeSteps)
+                    .withSamples(samples)
+                    .withSeed(mcSeed)
+                    .withConstantParameters(true)
+                );
+
+                Real NPV;
+                double time = timedNPV(barrierOption, NPV);
+
+                std::cout << spacer << c.type << spacer << timeSteps
+                          << spacer << NPV << spacer << barrierOption.errorEstimate()
+                          << spacer << time;
+
+                barrierOption.setPricingEngine(
+                    MakeMCBarrierEngine_2<PseudoRandom>(process)
+                    .withSteps(timeSteps)
+                    .withSamples(samples)
+                    .withSeed(mcSeed)
+                    .withConstantParameters(true)
+                    .withEarlyTermination(true)
+                );
+
+                time = timedNPV(barrierOption, NPV);
+
+                std::cout << spacer << NPV << spacer << barrierOption.errorEstimate()
+                          << spacer << time
+                          << spacer << barrierOption.result<Real>("simulatedStepsPerPath")
+                          << std::endl;
+            }
+        }
+        std::cout << std::endl;
+    }
+
+
+    // pricers branching on types at run time vs. specialized ones
+
+    // prices the paths a few times and returns the elapsed time in seconds
+    double timedPricing(const PathPricer<Path>& pricer,
+                        const std::vector<Path>& paths,
+                        Real& sum) {
+        Size passes = 10;
+        sum = 0.0;
+        auto startTime = std::chrono::steady_clock::now();
+        for (Size k=0; k<passes; k++)
+            for (const Path& path : paths)
+                sum += pricer(path);
+        auto endTime = std::chrono::steady_clock::now();
+        double us = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+        return us / 1000000;
+    }
+
+    void printPricers(const std::string& kind,
+                      const std::vector<Path>& paths,
+                      const PathPricer<Path>& runtime,
+                      const PathPricer<Path>& specialized) {
+        auto spacer = std::setw(width);
+        Real sum1, sum2;
+        double time1 = timedPricing(runtime, paths, sum1);
+        double time2 = timedPricing(specialized, paths, sum2);
+        std::cout << spacer << kind << spacer << time1 << spacer << time2
+                  << spacer << time1/time2
+                  << spacer << (sum1 == sum2 ? "yes" : "no")
+                  << std::endl;
+    }
+
+    void specializedPricers(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                            const Date& maturity) {
+
+        Size timeSteps = 100;
+        Size samples = 20000;
+        Size mcSeed = 42;
+        Real strike = 40, barrier = 40, rebate = 1;
+
+        auto constantProcess =
+            ext::make_shared<ConstantBlackScholesProcess>(process, maturity, strike);
+        TimeGrid grid(process->time(maturity), timeSteps);
+
+        std::vector<Path> paths;
+        PathGenerator<PseudoRandom::rsg_type> generator(
+            constantProcess, grid,
+            PseudoRandom::make_sequence_generator(timeSteps, mcSeed), false);
+        for (Size j=0; j<samples; j++)
+            paths.push_back(generator.next().value);
+
+        std::vector<DiscountFactor> discounts(grid.size());
+        for (Size i=0; i<grid.size(); i++)
+            discounts[i] = constantProcess->discount(grid[i]);
+
+        auto spacer = std::setw(width);
+        std::cout << "Pricers specialized on option and barrier type ("
+                  << samples << " paths, " << timeSteps << " steps)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "run time [s]"
+                  << spacer << "compiled [s]" << spacer << "speedup"
+                  << spacer << "same sum"
+                  << std::endl;
+
+        printPricers("European", paths,
+                     EuropeanPathPricer(Option::Put, strike, discounts.back()),
+                     EuropeanPathPricer_2<Option::Put>(strike, discounts.back()));
+
+        printPricers("biased", paths,
+                     BiasedBarrierPathPricer(Barrier::UpOut, barrier, rebate,
+                                             Option::Put, strike, discounts),
+                     BiasedBarrierPathPricer_2<Barrier::UpOut, Option::Put>(
+                         BiasedBarrierStepPricer<Barrier::UpOut, Option::Put>(
+                             barrier, rebate, strike, discounts)));
+
+        // both draw the same uniform sequences
+        printPricers("sampled", paths,
+                     BarrierPathPricer(Barrier::UpOut, barrier, rebate,
+                                       Option::Put, strike, discounts,
+                                       constantProcess,
+                                       PseudoRandom::ursg_type(timeSteps,
+                                                               PseudoRandom::urng_type(5))),
+                     BarrierPathPricer_2<Barrier::UpOut, Option::Put>(
+                         barrier, rebate, strike, discounts, constantProcess,
+                         PseudoRandom::ursg_type(timeSteps,
+                                                 PseudoRandom::urng_type(5))));
+
+        std::cout << std::endl;
+    }
+
+
+    // a book of seasoned Asians priced one by one vs. in a single batch
+
+    void printSeasonedBook(const std::string& kind,
+                           const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                           const std::vector<ext::shared_ptr<DiscreteAveragingAsianOption>>& book,
+                           Size samples,
+                           Size mcSeed) {
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<Real> values;
+        for (auto& option : book) {
+            option->setPricingEngine(
+                MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true));
+            values.push_back(option->NPV());
+        }
+        auto endTime = std::chrono::steady_clock::now();
+        double oneByOne = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        startTime = std::chrono::steady_clock::now();
+        MCDiscreteArithmeticASBatch_2<PseudoRandom> batch(
+            process, true, false, samples, Null<Real>(), Null<Size>(), mcSeed);
+        for (auto& option : book)
+            batch.add(option);
+        batch.calculate();
+        endTime = std::chrono::steady_clock::now();
+        double batched = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        Real maxDifference = 0.0;
+        for (Size i=0; i<book.size(); i++)
+            maxDifference = std::max(maxDifference,
+                                     std::fabs(values[i] - batch.NPV(i)));
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << oneByOne << spacer << batched
+                  << spacer << oneByOne/batched << spacer << maxDifference
+                  << std::endl;
+    }
+
+    void seasonedAsians(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                        const Date& maturity) {
+
+        Size samples = 100000;
+        Size mcSeed = 42;
+        Size bookSize = 20;
+
+        // the fixing dates in main.cpp
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+
+        // options with a few fixings already in the past
+        std::vector<ext::shared_ptr<DiscreteAveragingAsianOption>> book;
+        for (Size i=0; i<bookSize; i++) {
+            Option::Type type = (i % 2 == 0) ? Option::Put : Option::Call;
+            Size pastFixings = i % 5;
+            Real runningAccumulator = pastFixings * (34.0 + i % 3);
+            book.push_back(ext::make_shared<DiscreteAveragingAsianOption>(
+                Average::Arithmetic, runningAccumulator, pastFixings,
+                fixingDates, ext::make_shared<PlainVanillaPayoff>(type, 40),
+                exercise));
+        }
+
+        // the same, expiring after three, six or nine of the fixings
+        std::vector<ext::shared_ptr<DiscreteAveragingAsianOption>> mixedBook;
+        for (Size i=0; i<bookSize; i++) {
+            Option::Type type = (i % 2 == 0) ? Option::Put : Option::Call;
+            Size pastFixings = i % 5;
+            Real runningAccumulator = pastFixings * (34.0 + i % 3);
+            std::vector<Date> dates(fixingDates.begin(),
+                                    fixingDates.begin() + 3*(1 + i % 3));
+            mixedBook.push_back(ext::make_shared<DiscreteAveragingAsianOption>(
+                Average::Arithmetic, runningAccumulator, pastFixings,
+                dates, ext::make_shared<PlainVanillaPayoff>(type, 40),
+                ext::make_shared<EuropeanExercise>(dates.back())));
+        }
+
+        auto spacer = std::setw(width);
+        std::cout << "Book of " << bookSize << " seasoned Asians (constant parameters, "
+                  << samples << " samples)" << std::endl;
+        std::cout << spacer << "maturities" << spacer << "one by one [s]" << spacer << "batch [s]"
+                  << spacer << "speedup" << spacer << "max diff."
+                  << std::endl;
+        printSeasonedBook("same", process, book, samples, mcSeed);
+        printSeasonedBook("mixed", process, mixedBook, samples, mcSeed);
+        std::cout << std::endl;
+    }
+
+
+    // repricing after each change of the spot with a new engine vs. the same one
+
+    void printRepricing(const std::string& kind,
+                        Instrument& instrument,
+                        const ext::shared_ptr<SimpleQuote>& spot,
+                        const std::function<ext::shared_ptr<PricingEngine>()>& makeEngine,
+                        Size repricings) {
+        // the set-up is a small part of each calculation; the best of
+        // a few rounds keeps the comparison from being lost in noise
+        Size rounds = 5;
+        std::vector<Real> fresh, reused;
+        double freshTime = QL_MAX_REAL, reusedTime = QL_MAX_REAL;
+
+        for (Size k=0; k<rounds; k++) {
+            fresh.clear();
+            auto startTime = std::chrono::steady_clock::now();
+            for (Size i=0; i<repricings; i++) {
+                spot->setValue(36.0 + 0.01*i);
+                instrument.setPricingEngine(makeEngine());
+                fresh.push_back(instrument.NPV());
+            }
+            auto endTime = std::chrono::steady_clock::now();
+            freshTime = std::min(freshTime, std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0);
+
+            reused.clear();
+            instrument.setPricingEngine(makeEngine());
+            startTime = std::chrono::steady_clock::now();
+            for (Size i=0; i<repricings; i++) {
+                spot->setValue(36.0 + 0.01*i);
+                reused.push_back(instrument.NPV());
+            }
+            endTime = std::chrono::steady_clock::now();
+            reusedTime = std::min(reusedTime, std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0);
+        }
+
+        Real maxDifference = 0.0;
+        for (Size i=0; i<repricings; i++)
+            maxDifference = std::max(maxDifference, std::fabs(fresh[i] - reused[i]));
+
+        spot->setValue(36.0);
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << freshTime << spacer << reusedTime
+                  << spacer << freshTime/reusedTime << spacer << maxDifference
+                  << std::endl;
+    }
+
+    void repeatedRepricing(const Date& today, const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 1000;
+        Size mcSeed = 42;
+        Size repricings = 200;
+
+        auto spot = ext::make_shared<SimpleQuote>(36.0);
+        auto process = makeProcess(today, spot);
+
+        auto spacer = std::setw(width);
+        std::cout << repricings << " repricings after a change of the spot ("
+                  << samples << " samples, best of 5 rounds)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "new engine [s]"
+                  << spacer << "reused [s]" << spacer << "speedup"
+                  << spacer << "max diff."
+                  << std::endl;
+
+        for (bool constantParameters : {false, true}) {
+            std::string suffix = constantParameters ? " (c)" : "";
+
+            EuropeanOption european(
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printRepricing("European" + suffix, european, spot,
+                           [&]() -> ext::shared_ptr<PricingEngine> {
+                               return MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                                   .withSteps(timeSteps)
+                                   .withSamples(samples)
+                                   .withSeed(mcSeed)
+                                   .withConstantParameters(constantParameters);
+                           },
+                           repricings);
+
+            std::vector<Date> fixingDates = {
+                Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+                Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+                Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+            };
+            DiscreteAveragingAsianOption asian(
+                Average::Arithmetic, 0.0, 0, fixingDates,
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printRepricing("Asian" + suffix, asian, spot,
+                           [&]() -> ext::shared_ptr<PricingEngine> {
+                               return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                   .withSamples(samples)
+                                   .withSeed(mcSeed)
+                                   .withConstantParameters(constantParameters);
+                           },
+                           repricings);
+
+            BarrierOption barrierOption(
+                Barrier::UpIn, 40, 0,
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printRepricing("Barrier" + suffix, barrierOption, spot,
+                           [&]() -> ext::shared_ptr<PricingEngine> {
+                               return MakeMCBarrierEngine_2<PseudoRandom>(process)
+                                   .withSteps(timeSteps)
+                                   .withSamples(samples)
+                                   .withSeed(mcSeed)
+                                   .withConstantParameters(constantParameters);
+                           },
+                           repricings);
+        }
+
+        std::cout << std::endl;
+    }
+
+
+    // repricing through the engine vs. calls to the stateless kernel,
+    // sequential and from concurrent threads
+
+    void printKernel(const std::string& kind,
+                     Instrument& instrument,
+                     const ext::shared_ptr<SimpleQuote>& spot,
+                     const std::function<McKernelResult(const BlackScholesParameters&)>& kernel,
+                     const BlackScholesParameters& market,
+                     Size requests,
+                     Size threads) {
+        std::vector<Real> engineValues(requests), kernelValues(requests),
+            threadedValues(requests);
+        std::vector<BlackScholesParameters> markets(requests, market);
+        for (Size i=0; i<requests; i++)
+            markets[i].spot = market.spot + 0.01*i;
+
+        auto startTime = std::chrono::steady_clock::now();
+        for (Size i=0; i<requests; i++) {
+            spot->setValue(markets[i].spot);
+            engineValues[i] = instrument.NPV();
+        }
+        auto endTime = std::chrono::steady_clock::now();
+        double engineTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+        spot->setValue(market.spot);
+
+        startTime = std::chrono::steady_clock::now();
+        for (Size i=0; i<requests; i++)
+            kernelValues[i] = kernel(markets[i]).value;
+        endTime = std::chrono::steady_clock::now();
+        double kernelTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        startTime = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (Size t=0; t<threads; t++) {
+            workers.emplace_back([&, t]() {
+                for (Size i=t; i<requests; i+=threads)
+                    threadedValues[i] = kernel(markets[i]).value;
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        endTime = std::chrono::steady_clock::now();
+        double threadedTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        Real engineDifference = 0.0, threadedDifference = 0.0;
+        for (Size i=0; i<requests; i++) {
+            engineDifference = std::max(engineDifference,
+                                        std::fabs(engineValues[i] - kernelValues[i]));
+            threadedDifference = std::max(threadedDifference,
+                                          std::fabs(threadedValues[i] - kernelValues[i]));
+        }
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << engineTime << spacer << kernelTime
+                  << spacer << engineTime/kernelTime << spacer << engineDifference
+                  << spacer << threadedTime << spacer << threadedDifference
+                  << std::endl;
+    }
+
+    void pricingKernels(const Date& today, const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 1000;
+        Size mcSeed = 42;
+        Size requests = 200;
+        Size threads = 4;
+
+        DayCounter dayCounter = Actual365Fixed();
+        auto spot = ext::make_shared<SimpleQuote>(36.0);
+        auto process = ext::make_shared<BlackScholesProcess>(
+            Handle<Quote>(spot),
+            Handle<YieldTermStructure>(
+                ext::make_shared<FlatForward>(today, 0.01, dayCounter)),
+            Handle<BlackVolTermStructure>(
+                ext::make_shared<BlackConstantVol>(today, TARGET(), 0.20, dayCounter)));
+
+        BlackScholesParameters market;
+        market.spot = 36.0;
+        market.riskFreeRate = 0.01;
+        market.volatility = 0.20;
+        Time maturityTime = dayCounter.yearFraction(today, maturity);
+
+        McKernelSettings settings;
+        settings.timeSteps = timeSteps;
+        settings.requiredSamples = samples;
+        settings.seed = mcSeed;
+
+        auto spacer = std::setw(width);
+        std::cout << requests << " requests through the engine vs. the kernel ("
+                  << samples << " samples, " << threads << " threads)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "engine [s]"
+                  << spacer << "kernel [s]" << spacer << "speedup"
+                  << spacer << "max diff." << spacer << "threads [s]"
+                  << spacer << "max diff."
+                  << std::endl;
+
+        EuropeanOption european(
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        european.setPricingEngine(MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                                      .withSteps(timeSteps)
+                                      .withSamples(samples)
+                                      .withSeed(mcSeed)
+                                      .withConstantParameters(true)
+                                      .withFusedKernel());
+        EuropeanKernelParameters europeanParameters;
+        europeanParameters.type = Option::Put;
+        europeanParameters.strike = 40;
+        europeanParameters.maturity = maturityTime;
+        printKernel("European", european, spot,
+                    [&](const BlackScholesParameters& m) {
+                        return mcEuropeanKernel<PseudoRandom>(m, europeanParameters,
+                                                              settings);
+                    },
+                    market, requests, threads);
+
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        DiscreteAveragingAsianOption asian(
+            Average::Arithmetic, 0.0, 0, fixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        asian.setPricingEngine(MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                   .withSamples(samples)
+                                   .withSeed(mcSeed)
+                                   .withConstantParameters(true));
+        AverageStrikeAsianKernelParameters asianParameters;
+        asianParameters.type = Option::Put;
+        for (const Date& d : fixingDates)
+            asianParameters.fixingTimes.push_back(dayCounter.yearFraction(today, d));
+        asianParameters.maturity = maturityTime;
+        // the engine uses a Brownian bridge by default
+        McKernelSettings asianSettings = settings;
+        asianSettings.brownianBridge = true;
+        printKernel("Asian", asian, spot,
+                    [&](const BlackScholesParameters& m) {
+                        return mcAverageStrikeAsianKernel<PseudoRandom>(m, asianParameters,
+                                                                        asianSettings);
+                    },
+                    market, requests, threads);
+
+        BarrierOption barrierOption(
+            Barrier::UpIn, 40, 0,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        barrierOption.setPricingEngine(MakeMCBarrierEngine_2<PseudoRandom>(process)
+                                           .withSteps(timeSteps)
+                                           .withSamples(samples)
+                                           .withSeed(mcSeed)
+                                           .withConstantParameters(true)
+                                           .withFusedKernel());
+        BarrierKernelParameters barrierParameters;
+        barrierParameters.barrierType = Barrier::UpIn;
+        barrierParameters.barrier = 40;
+        barrierParameters.type = Option::Put;
+        barrierParameters.strike = 40;
+        barrierParameters.maturity = maturityTime;
+        printKernel("Barrier", barrierOption, spot,
+                    [&](const BlackScholesParameters& m) {
+                        return mcBarrierKernel<PseudoRandom>(m, barrierParameters,
+                                                             settings);
+                    },
+                    market, requests, threads);
+
+        std::cout << std::endl;
+    }
+
+
+    // running sums vs. compensated sums over very long simulations
+
+    template <class Accumulator>
+    void printStream(const std::string& kind,
+                     const std::vector<Real>& values,
+                     Size samples,
+                     long double exactMean) {
+        Accumulator accumulator;
+        auto startTime = std::chrono::steady_clock::now();
+        for (Size i=0; i<samples; i++)
+            accumulator.add(values[i % values.size()]);
+        Real mean = accumulator.mean();
+        auto endTime = std::chrono::steady_clock::now();
+        double time = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << samples << spacer << time
+                  << spacer << samples/time/1.0e6 << spacer << mean
+                  << spacer << std::fabs(static_cast<long double>(mean) - exactMean)
+                  << spacer << (accumulator.samples() == samples ? "yes" : "no")
+                  << std::endl;
+    }
+
+    // accumulators filled with consecutive slices of a stream and merged,
+    // compared to a single accumulator taking the whole stream
+    void printMerged(const std::vector<Real>& values,
+                     Size samples,
+                     Size parts) {
+        CompensatedStatistics single;
+        std::vector<CompensatedStatistics> slices(parts);
+        for (Size i=0; i<samples; i++) {
+            // an increasing trend, so that the slices have different means
+            Real value = values[i % values.size()] + Real(i)/Real(samples);
+            single.add(value);
+            slices[i*parts/samples].add(value);
+        }
+        CompensatedStatistics merged;
+        for (const auto& slice : slices)
+            merged.merge(slice);
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << parts << spacer << samples
+                  << spacer << std::fabs(merged.mean() - single.mean())
+                  << spacer << std::fabs(merged.variance() - single.variance())
+                  << spacer << (merged.samples() == single.samples() ? "yes" : "no")
+                  << std::endl;
+    }
+
+    // the running sum used by the simplest accumulators
+    class NaiveSum {
+      public:
+        void add(Real value) { sum_ += value; samples_++; }
+        Size samples() const { return samples_; }
+        Real mean() const { return sum_ / static_cast<Real>(samples_); }
+      private:
+        Real sum_ = 0.0;
+        Size samples_ = 0;
+    };
+
+    template <class S>
+    void printAnalytic(const std::string& kind,
+                       const BlackScholesParameters& market,
+                       const EuropeanKernelParameters& option,
+                       Size samples,
+                       Size mcSeed,
+                       Real analytic) {
+        McKernelSettings settings;
+        settings.requiredSamples = samples;
+        settings.seed = mcSeed;
+
+        auto startTime = std::chrono::steady_clock::now();
+        McKernelResult result = mcEuropeanKernel<PseudoRandom,S>(market, option, settings);
+        auto endTime = std::chrono::steady_clock::now();
+        double time = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << samples << spacer << time
+                  << spacer << samples/time/1.0e6 << spacer << result.value
+                  << spacer << std::fabs(result.value - analytic)/result.errorEstimate
+                  << std::endl;
+    }
+
+    void accumulationPrecision(const Date& today, const Date& maturity, bool longRuns) {
+
+        Size streamSamples = Size(1) << 30;
+        // past the range of a 32-bit counter
+        Size counterSamples = (Size(1) << 32) + (Size(1) << 20);
+        Size mergedSamples = Size(1) << 24;
+        Size storedSamples = 10000000;
+        Size longSamples = 100000000;
+        Size veryLongSamples = 1000000000;
+        Size mcSeed = 42;
+
+        // a stream cycling over a table of values, whose mean is known
+        std::vector<Real> values;
+        long double exactMean = 0.0L;
+        for (Size k=0; k<1024; k++) {
+            Real u = 0.6180339887498949 * k;
+            values.push_back(2.0 * (u - std::floor(u)));
+            exactMean += values.back();
+        }
+        exactMean /= values.size();
+
+        auto spacer = std::setw(width);
+        std::cout << "Mean of a stream of samples" << std::endl;
+        std::cout << spacer << "accumulator" << spacer << "samples" << spacer << "time [s]"
+                  << spacer << "Msamples/s" << spacer << "mean" << spacer << "error"
+                  << spacer << "all counted"
+                  << std::endl;
+        printStream<NaiveSum>("naive sum", values, streamSamples, exactMean);
+        printStream<AccumulatorState>("running mean", values, streamSamples, exactMean);
+        printStream<CompensatedStatistics>("compensated", values, streamSamples, exactMean);
+        if (longRuns)
+            printStream<CompensatedStatistics>("compensated", values, counterSamples,
+                                               exactMean);
+        std::cout << std::endl;
+
+        std::cout << "Merged vs. single compensated accumulator" << std::endl;
+        std::cout << spacer << "slices" << spacer << "samples" << spacer << "mean diff."
+                  << spacer << "var. diff." << spacer << "all counted"
+                  << std::endl;
+        printMerged(values, mergedSamples, 2);
+        printMerged(values, mergedSamples, 16);
+        std::cout << std::endl;
+
+        // a European put priced by the kernel, compared to the analytic price
+        BlackScholesParameters market;
+        market.spot = 36.0;
+        market.riskFreeRate = 0.01;
+        market.volatility = 0.20;
+        EuropeanKernelParameters option;
+        option.type = Option::Put;
+        option.strike = 40;
+        option.maturity = Actual365Fixed().yearFraction(today, maturity);
+        DiscountFactor discount = std::exp(-market.riskFreeRate * option.maturity);
+        Real analytic = blackFormula(option.type, option.strike, market.spot / discount,
+                                     market.volatility * std::sqrt(option.maturity),
+                                     discount);
+
+        std::cout << "European put vs. analytic price (" << analytic << ")" << std::endl;
+        std::cout << spacer << "accumulator" << spacer << "samples" << spacer << "time [s]"
+                  << spacer << "Msamples/s" << spacer << "NPV" << spacer << "diff./error"
+                  << std::endl;
+        // Statistics stores every sample, which limits the size of the run
+        printAnalytic<Statistics>("Statistics", market, option, storedSamples, mcSeed, analytic);
+        printAnalytic<CompensatedStatistics>("compensated", market, option, storedSamples,
+                                             mcSeed, analytic);
+        printAnalytic<CompensatedStatistics>("compensated", market, option, longSamples,
+                                             mcSeed, analytic);
+        if (longRuns) {
+            printAnalytic<CompensatedStatistics>("compensated", market, option,
+                                                 veryLongSamples, mcSeed, analytic);
+            printAnalytic<CompensatedStatistics>("compensated", market, option,
+                                                 counterSamples, mcSeed, analytic);
+        }
+        std::cout << std::endl;
+    }
+
+
+    // constant parameters taken at the exercise date vs. fitted over the
+    // fixing times, both compared to non-constant mode
+
+    void printFittedBias(const std::string& kind,
+                         Instrument& instrument,
+                         const std::function<ext::shared_ptr<PricingEngine>(bool, bool)>& makeEngine) {
+        instrument.setPricingEngine(makeEngine(false, false));
+        Real reference = instrument.NPV();
+        Real error = instrument.errorEstimate();
+        instrument.setPricingEngine(makeEngine(true, false));
+        Real terminal = instrument.NPV();
+        instrument.setPricingEngine(makeEngine(true, true));
+        Real fitted = instrument.NPV();
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << reference << spacer << error
+                  << spacer << terminal << spacer << terminal - reference
+                  << spacer << fitted << spacer << fitted - reference
+                  << std::endl;
+    }
+
+    void fittedParameters(const Date& today) {
+
+        Size samples = 100000;
+        Size mcSeed = 42;
+
+        // steep term structures within the life of the options
+        Date maturity = today + 6*Months;
+        auto process = makeProcess(today, ext::make_shared<SimpleQuote>(36.0),
+                                   {0.01, 0.05}, {0.15, 0.35});
+
+        auto spacer = std::setw(width);
+        std::cout << "Bias of constant parameters vs. non-constant mode, same random numbers ("
+                  << samples << " samples)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "NPV" << spacer << "error"
+                  << spacer << "exercise [NPV]" << spacer << "bias"
+                  << spacer << "fitted [NPV]" << spacer << "bias"
+                  << std::endl;
+
+        std::vector<Date> fixingDates;
+        for (Integer i=1; i<=6; i++)
+            fixingDates.push_back(today + i*Months);
+        DiscreteAveragingAsianOption asian(
+            Average::Arithmetic, 0.0, 0, fixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printFittedBias("Asian", asian,
+                        [&](bool constantParameters, bool fitted) -> ext::shared_ptr<PricingEngine> {
+                            return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                .withSamples(samples)
+                                .withSeed(mcSeed)
+                                .withConstantParameters(constantParameters)
+                                .withFittedParameters(fitted);
+                        });
+
+        // the last fixing is three months before the payment
+        std::vector<Date> earlyFixingDates(fixingDates.begin(), fixingDates.begin() + 3);
+        DiscreteAveragingAsianOption earlyAsian(
+            Average::Arithmetic, 0.0, 0, earlyFixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printFittedBias("Asian (early)", earlyAsian,
+                        [&](bool constantParameters, bool fitted) -> ext::shared_ptr<PricingEngine> {
+                            return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                .withSamples(samples)
+                                .withSeed(mcSeed)
+                                .withConstantParameters(constantParameters)
+                                .withFittedParameters(fitted);
+                        });
+
+        std::cout << std::endl;
+    }
+
+
+    // a market snapshot applied to a book of options, with and without a transaction
+
+    struct SnapshotMarket {
+        Date today;
+        ext::shared_ptr<SimpleQuote> spot, rate;
+        RelinkableHandle<BlackVolTermStructure> volatility;
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process;
+    };
+
+    // the feed delivers several ticks of the spot, a new rate and a new vol curve
+    void applySnapshot(SnapshotMarket& market, Size snapshot, Size spotTicks) {
+        for (Size i=0; i<spotTicks; i++)
+            market.spot->setValue(36.0 + 0.1*snapshot + 0.01*i);
+        market.rate->setValue(0.01 + 0.001*snapshot);
+        market.volatility.linkTo(
+            ext::make_shared<BlackConstantVol>(market.today, TARGET(),
+                                               0.20 + 0.01*snapshot,
+                                               Actual365Fixed()));
+    }
+
+    std::vector<Real> priceBook(const std::vector<ext::shared_ptr<Instrument> >& book) {
+        std::vector<Real> prices(book.size());
+        for (Size i=0; i<book.size(); i++)
+            prices[i] = book[i]->NPV();
+        return prices;
+    }
+
+    void printMarketSnapshot(const std::string& kind,
+                             SnapshotMarket& market,
+                             const std::vector<ext::shared_ptr<Instrument> >& book,
+                             const std::vector<ext::shared_ptr<PricingEngine> >& engines,
+                             bool transaction,
+                             Size workers,
+                             Size spotTicks,
+                             std::vector<Real>& reference) {
+        // start from a fully calculated book on the base market
+        applySnapshot(market, 0, spotTicks);
+        priceBook(book);
+
+        NotificationCounter processNotifications, engineNotifications,
+            instrumentNotifications;
+        processNotifications.registerWith(market.process);
+        for (const auto& engine : engines)
+            engineNotifications.registerWith(engine);
+        for (const auto& instrument : book)
+            instrumentNotifications.registerWith(instrument);
+
+        // the notifications received by the options while the snapshot
+        // is incomplete, i.e., when they might be priced on a partial one
+        Size partialNotifications;
+        auto startTime = std::chrono::steady_clock::now();
+        if (transaction) {
+            MarketUpdate update;
+            applySnapshot(market, 1, spotTicks);
+            partialNotifications = instrumentNotifications.count();
+            update.commit();
+        } else {
+            applySnapshot(market, 1, spotTicks);
+            partialNotifications = instrumentNotifications.count();
+        }
+        std::vector<Real> prices = workers > 1 ? valuesInWorkers(book, workers)
+                                               : priceBook(book);
+        auto endTime = std::chrono::steady_clock::now();
+        double latency = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        if (reference.empty())
+            reference = prices;
+        Real maxDifference = 0.0;
+        for (Size i=0; i<prices.size(); i++)
+            maxDifference = std::max(maxDifference, std::fabs(prices[i] - reference[i]));
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind
+                  << spacer << processNotifications.count()
+                  << spacer << engineNotifications.count()
+                  << spacer << instrumentNotifications.count()
+                  << spacer << partialNotifications
+                  << spacer << latency << spacer << maxDifference
+                  << std::endl;
+    }
+
+    void marketSnapshots(const Date& today, const Date& maturity) {
+
+        Size options = 10000;
+        Size samples = 200;
+        Size mcSeed = 42;
+        Size spotTicks = 5;
+
+        SnapshotMarket market;
+        market.today = today;
+        market.spot = ext::make_shared<SimpleQuote>(36.0);
+        market.rate = ext::make_shared<SimpleQuote>(0.01);
+        market.volatility.linkTo(
+            ext::make_shared<BlackConstantVol>(today, TARGET(), 0.20, Actual365Fixed()));
+        market.process = ext::make_shared<BlackScholesProcess>(
+            Handle<Quote>(market.spot),
+            Handle<YieldTermStructure>(
+                ext::make_shared<FlatForward>(today, Handle<Quote>(market.rate),
+                                              Actual365Fixed())),
+            market.volatility);
+
+        // each option has its own engine, as when they are set up independently
+        std::vector<ext::shared_ptr<Instrument> > book;
+        std::vector<ext::shared_ptr<PricingEngine> > engines;
+        for (Size i=0; i<options; i++) {
+            auto option = ext::make_shared<EuropeanOption>(
+                ext::make_shared<PlainVanillaPayoff>(i % 2 == 0 ? Option::Put : Option::Call,
+                                                     30.0 + 20.0*i/options),
+                ext::make_shared<EuropeanExercise>(maturity));
+            ext::shared_ptr<PricingEngine> engine =
+                MakeMCEuropeanEngine_2<PseudoRandom>(market.process)
+                .withSteps(1)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel();
+            option->setPricingEngine(engine);
+            book.push_back(option);
+            engines.push_back(engine);
+        }
+
+        auto spacer = std::setw(width);
+        std::cout << "Market snapshot (" << spotTicks << " spot ticks, rate, vol) on "
+                  << options << " European options (" << samples << " samples each)"
+                  << std::endl;
+        std::cout << spacer << "kind" << spacer << "process notif."
+                  << spacer << "engine notif." << spacer << "option notif."
+                  << spacer << "during update" << spacer << "latency [s]" << spacer << "max diff."
+                  << std::endl;
+
+        std::vector<Real> reference;
+        printMarketSnapshot("immediate", market, book, engines, false, 1,
+                            spotTicks, reference);
+        printMarketSnapshot("transaction", market, book, engines, true, 1,
+                            spotTicks, reference);
+        #ifdef QL_SHARD_LAUNCHER_FORK
+        for (Size workers : {2, 4})
+            printMarketSnapshot("tx, " + std::to_string(workers) + " workers",
+                                market, book, engines, true, workers,
+                                spotTicks, reference);
+        #endif
+
+        std::cout << std::endl;
+    }
+
+
+    // a simulation split among forked workers and merged
+
+    void printSharded(const std::string& kind,
+                      Instrument& instrument,
+                      const std::function<ext::shared_ptr<PricingEngine>(const ShardRange&)>& makeEngine,
+                      Size samples) {
+        auto spacer = std::setw(width);
+
+        // the reference: a single shard with all the samples
+        auto startTime = std::chrono::steady_clock::now();
+        instrument.setPricingEngine(makeEngine(ShardRange(0, samples)));
+        Real reference = instrument.NPV();
+        auto endTime = std::chrono::steady_clock::now();
+        double singleTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+        for (Size workers : {1, 2, 4, 8}) {
+            std::vector<ShardRange> shards = splitSamples(samples, workers);
+
+            startTime = std::chrono::steady_clock::now();
+            std::vector<std::string> blobs =
+                runInWorkers(workers, [&](Size i) {
+                    instrument.setPricingEngine(makeEngine(shards[i]));
+                    return instrument.result<std::string>("shardState");
+                });
+            std::vector<ShardState> states;
+            for (auto& blob : blobs)
+                states.push_back(ShardState::deserialize(blob));
+            ShardState merged = mergeShards(states);
+            Real value = merged.total().mean();
+            endTime = std::chrono::steady_clock::now();
+            double shardedTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0;
+
+            std::cout << spacer << kind << spacer << workers << spacer << shardedTime
+                      << spacer << singleTime/shardedTime << spacer << value
+                      << spacer << std::fabs(value - reference)
+                      << spacer << blobs.front().size()
+                      << std::endl;
+        }
+    }
+
+    void shardedSimulation(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                           const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 16 * ShardRange::defaultBlockSize;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Sharded simulation (constant parameters, "
+                  << samples << " samples)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "workers" << spacer << "time [s]"
+                  << spacer << "speedup" << spacer << "NPV"
+                  << spacer << "diff." << spacer << "state [bytes]"
+                  << std::endl;
+
+        EuropeanOption european(
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printSharded("European", european,
+                     [&](const ShardRange& shard) -> ext::shared_ptr<PricingEngine> {
+                         return MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                             .withSteps(timeSteps)
+                             .withSeed(mcSeed)
+                             .withConstantParameters(true)
+                             .withShard(shard.begin, shard.end);
+                     },
+                     samples);
+
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        DiscreteAveragingAsianOption asian(
+            Average::Arithmetic, 0.0, 0, fixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printSharded("Asian", asian,
+                     [&](const ShardRange& shard) -> ext::shared_ptr<PricingEngine> {
+                         return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                             .withSeed(mcSeed)
+                             .withConstantParameters(true)
+                             .withShard(shard.begin, shard.end);
+                     },
+                     samples);
+
+        BarrierOption barrierOption(
+            Barrier::UpIn, 40, 0,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printSharded("Barrier", barrierOption,
+                     [&](const ShardRange& shard) -> ext::shared_ptr<PricingEngine> {
+                         return MakeMCBarrierEngine_2<PseudoRandom>(process)
+                             .withSteps(timeSteps)
+                             .withSeed(mcSeed)
+                             .withConstantParameters(true)
+                             .withShard(shard.begin, shard.end);
+                     },
+                     samples);
+
+        // adjacent seeds must not share the streams of their blocks
+        auto blockNPV = [&](BigNatural seed, Size block) {
+            Size blockSize = ShardRange::defaultBlockSize;
+            european.setPricingEngine(MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                                          .withSteps(timeSteps)
+                                          .withSeed(seed)
+                                          .withConstantParameters(true)
+                                          .withShard(block*blockSize, (block+1)*blockSize));
+            return european.NPV();
+        };
+        Real block1 = blockNPV(mcSeed, 1);
+        Real nextBlock1 = blockNPV(mcSeed+1, 1), nextBlock0 = blockNPV(mcSeed+1, 0);
+        std::cout << "European block 1 with seed " << mcSeed << ": " << block1
+                  << "; with seed " << mcSeed+1 << ": " << nextBlock1
+                  << " (block 0: " << nextBlock0 << "); "
+                  << (block1 != nextBlock1 && block1 != nextBlock0 ?
+                      "different streams" : "shared streams")
+                  << std::endl;
+
+        // nor seeds differing only above the lower 32 bits
+        BigNatural highBit = BigNatural(0xffffffffUL) + 1;
+        if (highBit != 0) {
+            Real highBlock1 = blockNPV(mcSeed + highBit, 1);
+            std::cout << "European block 1 with seed " << mcSeed + highBit << ": "
+                      << highBlock1 << "; "
+                      << (highBlock1 != block1 ? "different streams" : "shared streams")
+                      << std::endl;
+        }
+
+        std::cout << std::endl;
+    }
+
+
+    // a simulation extended from a checkpoint vs. a single larger run
+
+    void printCheckpoint(const std::string& kind,
+                         Instrument& instrument,
+                         const std::function<ext::shared_ptr<PricingEngine>(
+                             Size, const ext::shared_ptr<McCheckpoint>&)>& makeEngine,
+                         Size samples) {
+        instrument.setPricingEngine(makeEngine(2*samples, nullptr));
+        Real singleNPV;
+        double singleTime = timedNPV(instrument, singleNPV);
+
+        auto checkpoint = ext::make_shared<McCheckpoint>();
+        instrument.setPricingEngine(makeEngine(samples, checkpoint));
+        Real firstNPV;
+        double firstTime = timedNPV(instrument, firstNPV);
+        instrument.setPricingEngine(makeEngine(2*samples, checkpoint));
+        Real extendedNPV;
+        double extensionTime = timedNPV(instrument, extendedNPV);
+        Size reused = instrument.result<Size>("reusedSamples");
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind << spacer << singleTime
+                  << spacer << firstTime << spacer << extensionTime
+                  << spacer << reused << spacer << extendedNPV
+                  << spacer << std::fabs(extendedNPV - singleNPV)
+                  << std::endl;
+    }
+
+    void checkpointedSimulation(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                                const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 100000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Simulation extended from " << samples << " to " << 2*samples
+                  << " samples" << std::endl;
+        std::cout << spacer << "kind" << spacer << "single [s]"
+                  << spacer << "first [s]" << spacer << "extension [s]"
+                  << spacer << "reused" << spacer << "NPV" << spacer << "diff."
+                  << std::endl;
+
+        for (bool constantParameters : {false, true}) {
+            std::string suffix = constantParameters ? " (c)" : "";
+
+            EuropeanOption european(
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printCheckpoint("European" + suffix, european,
+                            [&](Size samples, const ext::shared_ptr<McCheckpoint>& checkpoint)
+                                -> ext::shared_ptr<PricingEngine> {
+                                return MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                                    .withSteps(timeSteps)
+                                    .withSamples(samples)
+                                    .withSeed(mcSeed)
+                                    .withConstantParameters(constantParameters)
+                                    .withCheckpoint(checkpoint);
+                            },
+                            samples);
+
+            std::vector<Date> fixingDates = {
+                Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+                Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+                Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+            };
+            DiscreteAveragingAsianOption asian(
+                Average::Arithmetic, 0.0, 0, fixingDates,
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printCheckpoint("Asian" + suffix, asian,
+                            [&](Size samples, const ext::shared_ptr<McCheckpoint>& checkpoint)
+                                -> ext::shared_ptr<PricingEngine> {
+                                return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                    .withSamples(samples)
+                                    .withSeed(mcSeed)
+                                    .withConstantParameters(constantParameters)
+                                    .withCheckpoint(checkpoint);
+                            },
+                            samples);
+
+            BarrierOption barrierOption(
+                Barrier::UpIn, 40, 0,
+                ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+                ext::make_shared<EuropeanExercise>(maturity));
+            printCheckpoint("Barrier" + suffix, barrierOption,
+                            [&](Size samples, const ext::shared_ptr<McCheckpoint>& checkpoint)
+                                -> ext::shared_ptr<PricingEngine> {
+                                return MakeMCBarrierEngine_2<PseudoRandom>(process)
+                                    .withSteps(timeSteps)
+                                    .withSamples(samples)
+                                    .withSeed(mcSeed)
+                                    .withConstantParameters(constantParameters)
+                                    .withCheckpoint(checkpoint);
+                            },
+                            samples);
+        }
+
+        std::cout << std::endl;
+    }
+
+
+    // where the time goes: per-phase profile of the main.cpp engines
+
+    void printProfile(const std::string& kind,
+                      Instrument& instrument,
+                      const std::function<ext::shared_ptr<PricingEngine>(bool)>& makeEngine) {
+        instrument.setPricingEngine(makeEngine(false));
+        Real NPV;
+        double plainTime = timedNPV(instrument, NPV);
+
+        instrument.setPricingEngine(makeEngine(true));
+        Real profiledNPV;
+        double profiledTime = timedNPV(instrument, profiledNPV);
+
+        auto spacer = std::setw(width);
+        std::cout << spacer << kind;
+        // random numbers, evolution and statistics are estimated
+        for (const char* result : {"setupTime", "calibrationTime",
+                                   "randomNumbersTimeEstimate", "pathEvolutionTimeEstimate",
+                                   "payoffTime", "statisticsTimeEstimate", "totalTime"}) {
+            Real seconds = instrument.result<Real>(std::string("profile.") + result);
+            std::cout << spacer << seconds;
+        }
+        std::cout << spacer << instrument.result<Real>("profile.paths")
+                  << spacer << instrument.result<Real>("profile.steps");
+        std::cout << spacer << plainTime << spacer << profiledTime
+                  << spacer << (NPV == profiledNPV ? "yes" : "no")
+                  << std::endl;
+    }
+
+    void profiles(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                  const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 1000000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Per-phase profile of the main.cpp engines (" << samples
+                  << " samples, times in seconds)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "setup" << spacer << "calibration"
+                  << spacer << "random nr. (e)" << spacer << "evolution (e)"
+                  << spacer << "payoff" << spacer << "statistics (e)" << spacer << "total"
+                  << spacer << "paths" << spacer << "steps"
+                  << spacer << "not profiled" << spacer << "profiled"
+                  << spacer << "same NPV"
+                  << std::endl;
+
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+
+        EuropeanOption european(payoff, exercise);
+        DiscreteAveragingAsianOption asian(Average::Arithmetic, 0.0, 0, fixingDates,
+                                           payoff, exercise);
+        BarrierOption barrierOption(Barrier::UpIn, 40, 0, payoff, exercise);
+
+        for (bool constantParameters : {false, true}) {
+            std::string suffix = constantParameters ? " (c)" : "";
+
+            printProfile("European" + suffix, european,
+                         [&](bool profiling) -> ext::shared_ptr<PricingEngine> {
+                             return MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                                 .withSteps(timeSteps)
+                                 .withSamples(samples)
+                                 .withSeed(mcSeed)
+                                 .withConstantParameters(constantParameters)
+                                 .withProfiling(profiling);
+                         });
+
+            printProfile("Asian" + suffix, asian,
+                         [&](bool profiling) -> ext::shared_ptr<PricingEngine> {
+                             return MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                                 .withSamples(samples)
+                                 .withSeed(mcSeed)
+                                 .withConstantParameters(constantParameters)
+                                 .withProfiling(profiling);
+                         });
+
+            printProfile("Barrier" + suffix, barrierOption,
+                         [&](bool profiling) -> ext::shared_ptr<PricingEngine> {
+                             return MakeMCBarrierEngine_2<PseudoRandom>(process)
+                                 .withSteps(timeSteps)
+                                 .withSamples(samples)
+                                 .withSeed(mcSeed)
+                                 .withConstantParameters(constantParameters)
+                                 .withProfiling(profiling);
+                         });
+        }
+
+        printProfile("Barrier (e.t.)", barrierOption,
+                     [&](bool profiling) -> ext::shared_ptr<PricingEngine> {
+                         return MakeMCBarrierEngine_2<PseudoRandom>(process)
+                             .withSteps(timeSteps)
+                             .withSamples(samples)
+                             .withSeed(mcSeed)
+                             .withConstantParameters(true)
+                             .withEarlyTermination(true)
+                             .withProfiling(profiling);
+                     });
+
+        std::cout << std::endl;
+    }
+
+
+    // paths built and priced vs. fused generation and pricing
+
+    void printFusedKernel(const std::string& kind,
+                          Size steps,
+                          Size samples,
+                          Instrument& instrument,
+                          const ext::shared_ptr<PricingEngine>& paths,
+                          const ext::shared_ptr<PricingEngine>& fused) {
+        auto spacer = std::setw(width);
+        // millions of simulated steps per second
+        Real work = Real(steps)*Real(samples)/1.0e6;
+
+        instrument.setPricingEngine(paths);
+        Real NPV;
+        double time = timedNPV(instrument, NPV);
+        std::cout << spacer << kind << spacer << steps
+                  << spacer << NPV << spacer << time << spacer << work/time;
+
+        instrument.setPricingEngine(fused);
+        double fusedTime = timedNPV(instrument, NPV);
+        std::cout << spacer << NPV << spacer << fusedTime
+                  << spacer << work/fusedTime
+                  << spacer << time/fusedTime << std::endl;
+    }
+
+    void fusedKernel(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                     const Date& maturity) {
+
+        Size totalSteps = 20000000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Fused kernel (constant parameters, "
+                  << totalSteps << " steps per run)" << std::endl;
+        std::cout << std::setw(90) << "paths"
+                  << std::setw(45) << "fused"
+                  << std::endl;
+        std::cout << spacer << "kind" << spacer << "grid steps"
+                  << spacer << "NPV" << spacer << "time [s]" << spacer << "Msteps/s"
+                  << spacer << "NPV" << spacer << "time [s]" << spacer << "Msteps/s"
+                  << spacer << "speedup"
+                  << std::endl;
+
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+
+        // the European and barrier options in main.cpp
+        for (Size steps : std::vector<Size>{10, 100, 1000}) {
+            Size samples = totalSteps/steps;
+            EuropeanOption option(payoff, exercise);
+            printFusedKernel(
+                "european", steps, samples, option,
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(false),
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(true));
+        }
+        for (Size steps : std::vector<Size>{10, 100, 1000}) {
+            Size samples = totalSteps/steps;
+            BarrierOption option(Barrier::UpIn, 40, 0, payoff, exercise);
+            printFusedKernel(
+                "barrier", steps, samples, option,
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(false),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(true));
+        }
+        // a knock-out paying a rebate when the barrier is hit
+        for (Size steps : std::vector<Size>{10, 100, 1000}) {
+            Size samples = totalSteps/steps;
+            BarrierOption option(Barrier::UpOut, 40, 1.0, payoff, exercise);
+            printFusedKernel(
+                "rebate", steps, samples, option,
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(false),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(steps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withFusedKernel(true));
+        }
+        std::cout << std::endl;
+    }
+
+
+    // plain, stratified and moment-matched sampling
+
+    void printSamplingSchemes(const std::string& kind,
+                              Instrument& instrument,
+                              const std::vector<ext::shared_ptr<PricingEngine>>& engines) {
+        auto spacer = std::setw(width);
+
+        std::cout << spacer << kind;
+        Real plainCost = Null<Real>();
+        for (const auto& engine : engines) {
+            instrument.setPricingEngine(engine);
+            Real NPV;
+            double time = timedNPV(instrument, NPV);
+            Real error = instrument.errorEstimate();
+            // variance times time, i.e., the cost of a given accuracy
+            Real cost = error*error*time;
+            if (plainCost == Null<Real>())
+                plainCost = cost;
+            std::cout << spacer << NPV << spacer << error << spacer << time
+                      << spacer << plainCost/cost;
+        }
+        std::cout << std::endl;
+    }
+
+    void samplingSchemes(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                         const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 100000;
+        Size mcSeed = 42;
+        Size batchSize = 64;
+
+        auto spacer = std::setw(width);
+        std::cout << "Sampling schemes (constant parameters, "
+                  << samples << " samples, batches of " << batchSize << ")"
+                  << std::endl;
+        std::cout << std::setw(75) << "plain"
+                  << std::setw(60) << "stratified"
+                  << std::setw(60) << "moment matching"
+                  << std::endl;
+        std::cout << spacer << "kind";
+        for (Size i=0; i<3; i++)
+            std::cout << spacer << "NPV" << spacer << "error"
+                      << spacer << "time [s]" << spacer << "efficiency";
+        std::cout << std::endl;
+
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+
+        // the European option in main.cpp and an out-of-the-money one
+        for (Real strike : std::vector<Real>{40, 30}) {
+            auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, strike);
+            EuropeanOption option(payoff, exercise);
+            std::ostringstream kind;
+            kind << "put " << strike;
+            printSamplingSchemes(kind.str(), option, {
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withStratifiedSampling(batchSize),
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withMomentMatching(batchSize)
+            });
+        }
+
+        // the barrier option in main.cpp and a knock-out
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+        struct { Barrier::Type type; Real barrier; } cases[] = {
+            { Barrier::UpIn, 40 }, { Barrier::UpOut, 45 }
+        };
+        for (auto c : cases) {
+            BarrierOption option(c.type, c.barrier, 0, payoff, exercise);
+            std::ostringstream kind;
+            kind << (c.type == Barrier::UpIn ? "up-in " : "up-out ") << c.barrier;
+            printSamplingSchemes(kind.str(), option, {
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withStratifiedSampling(batchSize),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withMomentMatching(batchSize)
+            });
+        }
+
+        // the Asian option in main.cpp
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        DiscreteAveragingAsianOption asian(
+            Average::Arithmetic, 0.0, 0, fixingDates, payoff, exercise);
+        printSamplingSchemes("asian", asian, {
+            MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+            .withSamples(samples)
+            .withSeed(mcSeed)
+            .withConstantParameters(true),
+            MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+            .withSamples(samples)
+            .withSeed(mcSeed)
+            .withConstantParameters(true)
+            .withStratifiedSampling(batchSize),
+            MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+            .withSamples(samples)
+            .withSeed(mcSeed)
+            .withConstantParameters(true)
+            .withMomentMatching(batchSize)
+        });
+        std::cout << std::endl;
+    }
+
+
+    // plain sampling vs. vanilla control variate
+
+    void printControlVariate(const std::string& kind,
+                             Instrument& instrument,
+                             const ext::shared_ptr<PricingEngine>& plain,
+                             const ext::shared_ptr<PricingEngine>& controlled) {
+        auto spacer = std::setw(width);
+
+        instrument.setPricingEngine(plain);
+        Real NPV;
+        double time = timedNPV(instrument, NPV);
+        Real plainError = instrument.errorEstimate();
+        std::cout << spacer << kind << spacer << NPV << spacer << plainError
+                  << spacer << time;
+
+        instrument.setPricingEngine(controlled);
+        time = timedNPV(instrument, NPV);
+        Real error = instrument.errorEstimate();
+        std::cout << spacer << NPV << spacer << error << spacer << time
+                  << spacer
+                  << instrument.result<Real>("controlVariateCoefficient");
+        Real reduction =
+            instrument.result<Real>("controlVariateVarianceReduction");
+        if (reduction != Null<Real>())
+            std::cout << spacer << reduction;
+        else
+            std::cout << spacer << "n/a";
+        std::cout << spacer << (plainError*plainError)/(error*error)
+                  << std::endl;
+    }
+
+    void controlVariates(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                         const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 100000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Control variates (constant parameters, "
+                  << samples << " samples)" << std::endl;
+        std::cout << std::setw(60) << "plain"
+                  << std::setw(45) << "control variate"
+                  << std::endl;
+        std::cout << spacer << "kind"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "coefficient" << spacer << "reported"
+                  << spacer << "var. ratio"
+                  << std::endl;
+
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+
+        // the barrier option in main.cpp and a few variations
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+        struct { Barrier::Type type; Real barrier; } cases[] = {
+            { Barrier::UpIn, 40 }, { Barrier::UpOut, 40 },
+            { Barrier::UpOut, 45 }, { Barrier::DownOut, 30 }
+        };
+        for (auto c : cases) {
+            BarrierOption option(c.type, c.barrier, 0, payoff, exercise);
+            std::ostringstream kind;
+            kind << (c.type == Barrier::UpIn ? "up-in " :
+                     c.type == Barrier::UpOut ? "up-out " : "down-out ")
+                 << c.barrier;
+            printControlVariate(
+                kind.str(), option,
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withControlVariate(true));
+        }
+
+        // the Asian option in main.cpp, with both option types
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        for (Option::Type type : { Option::Put, Option::Call }) {
+            DiscreteAveragingAsianOption option(
+                Average::Arithmetic, 0.0, 0, fixingDates,
+                ext::make_shared<PlainVanillaPayoff>(type, 40), exercise);
+            printControlVariate(
+                type == Option::Put ? "asian put" : "asian call", option,
+                MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCDiscreteArithmeticASEngine_2<PseudoRandom>(process)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withControlVariate(true));
+        }
+        std::cout << std::endl;
+    }
+
+
+    // plain sampling vs. drift shift calibrated on a pilot run
+
+    void printImportanceSampling(const std::string& kind,
+                                 Instrument& instrument,
+                                 const ext::shared_ptr<PricingEngine>& plain,
+                                 const ext::shared_ptr<PricingEngine>& shifted) {
+        auto spacer = std::setw(width);
+
+        instrument.setPricingEngine(plain);
+        Real NPV;
+        double time = timedNPV(instrument, NPV);
+        Real plainError = instrument.errorEstimate();
+        std::cout << spacer << kind << spacer << NPV << spacer << plainError
+                  << spacer << time;
+
+        instrument.setPricingEngine(shifted);
+        time = timedNPV(instrument, NPV);
+        Real error = instrument.errorEstimate();
+        std::cout << spacer << NPV << spacer << error << spacer << time
+                  << spacer << instrument.result<Real>("driftShift");
+        Real estimated = instrument.result<Real>("estimatedVarianceReduction");
+        if (estimated != Null<Real>())
+            std::cout << spacer << estimated;
+        else
+            std::cout << spacer << "n/a";
+        std::cout << spacer << (plainError*plainError)/(error*error)
+                  << std::endl;
+    }
+
+    void importanceSampling(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                            const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 100000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Importance sampling (constant parameters, "
+                  << samples << " samples)" << std::endl;
+        std::cout << std::setw(60) << "plain"
+                  << std::setw(45) << "importance sampling"
+                  << std::endl;
+        std::cout << spacer << "kind"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "NPV" << spacer << "error" << spacer << "time [s]"
+                  << spacer << "shift" << spacer << "est. ratio"
+                  << spacer << "var. ratio"
+                  << std::endl;
+
+        auto exercise = ext::make_shared<EuropeanExercise>(maturity);
+
+        // out-of-the-money versions of the European option in main.cpp
+        for (Real strike : std::vector<Real>{30, 25}) {
+            auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, strike);
+            EuropeanOption option(payoff, exercise);
+            std::ostringstream kind;
+            kind << "put " << strike;
+            printImportanceSampling(
+                kind.str(), option,
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCEuropeanEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withImportanceSampling(true));
+        }
+
+        // the barrier option in main.cpp and rarer knock-ins
+        auto payoff = ext::make_shared<PlainVanillaPayoff>(Option::Put, 40);
+        struct { Barrier::Type type; Real barrier; } cases[] = {
+            { Barrier::UpIn, 40 }, { Barrier::DownIn, 30 }, { Barrier::DownIn, 26 }
+        };
+        for (auto c : cases) {
+            BarrierOption option(c.type, c.barrier, 0, payoff, exercise);
+            std::ostringstream kind;
+            kind << (c.type == Barrier::UpIn ? "up-in " : "down-in ") << c.barrier;
+            printImportanceSampling(
+                kind.str(), option,
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true),
+                MakeMCBarrierEngine_2<PseudoRandom>(process)
+                .withSteps(timeSteps)
+                .withSamples(samples)
+                .withSeed(mcSeed)
+                .withConstantParameters(true)
+                .withImportanceSampling(true));
+        }
+        std::cout << std::endl;
+    }
+
+
+    // adjoint curve-node sensitivities vs. bump and reprice
+
+    void printCurveSensitivities(
+                 const std::string& kind,
+                 Instrument& instrument,
+                 const Date& today,
+                 const std::function<ext::shared_ptr<PricingEngine>(
+                     const ext::shared_ptr<GeneralizedBlackScholesProcess>&,
+                     bool)>& makeEngine) {
+        std::vector<Rate> rates = {0.01, 0.015};
+        std::vector<Volatility> vols = {0.20, 0.25};
+        auto spot = ext::make_shared<SimpleQuote>(36.0);
+        auto process = makeProcess(today, spot, rates, vols);
+
+        instrument.setPricingEngine(makeEngine(process, false));
+        Real plainNPV;
+        double plainTime = timedNPV(instrument, plainNPV);
+
+        instrument.setPricingEngine(makeEngine(process, true));
+        Real adjointNPV;
+        double adjointTime = timedNPV(instrument, adjointNPV);
+        std::vector<Real> adjoint =
+            instrument.result<std::vector<Real> >("zeroRateSensitivities");
+        std::vector<Real> vega =
+            instrument.result<std::vector<Real> >("volatilitySensitivities");
+        adjoint.insert(adjoint.end(), vega.begin(), vega.end());
+
+        // central differences with the same seed
+        Real h = 1.0e-4;
+        std::vector<Real> bumped;
+        auto startTime = std::chrono::steady_clock::now();
+        for (Size i=0; i<rates.size()+vols.size(); i++) {
+            Real values[2];
+            for (Size j=0; j<2; j++) {
+                std::vector<Rate> r = rates;
+                std::vector<Volatility> v = vols;
+                Real shift = j == 0 ? h : -h;
+                if (i < rates.size())
+                    r[i] += shift;
+                else
+                    v[i-rates.size()] += shift;
+                instrument.setPricingEngine(
+                    makeEngine(makeProcess(today, spot, r, v), false));
+                values[j] = instrument.NPV();
+            }
+            bumped.push_back((values[0] - values[1]) / (2*h));
+        }
+        auto endTime = std::chrono::steady_clock::now();
+        double bumpedTime =
+            std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1.0e6;
+
+        auto spacer = std::setw(width);
+        std::string nodes[] = { "r(0)", "r(6M)", "vol(3M)", "vol(6M)" };
+        for (Size i=0; i<adjoint.size(); i++) {
+            std::cout << spacer << kind << spacer << nodes[i]
+                      << spacer << adjoint[i] << spacer << bumped[i]
+                      << spacer << std::fabs(adjoint[i] - bumped[i]);
+            if (i == 0)
+                std::cout << spacer << plainTime << spacer << adjointTime
+                          << spacer << bumpedTime;
+            std::cout << std::endl;
+        }
+        QL_REQUIRE(std::fabs(adjointNPV - plainNPV) < 1e-12,
+                   "adjoint run changed the value");
+    }
+
+    void curveSensitivities(const Date& today, const Date& maturity) {
+
+        Size timeSteps = 10;
+        Size samples = 100000;
+        Size mcSeed = 42;
+
+        auto spacer = std::setw(width);
+        std::cout << "Curve-node sensitivities (non constant, " << samples
+                  << " samples)" << std::endl;
+        std::cout << spacer << "kind" << spacer << "node"
+                  << spacer << "adjoint" << spacer << "bumped" << spacer << "diff."
+                  << spacer << "plain [s]" << spacer << "adjoint [s]"
+                  << spacer << "bumped [s]" << std::endl;
+
+        std::vector<Date> volatilityNodes = { today + 3*Months, today + 6*Months };
+
+        EuropeanOption european(
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printCurveSensitivities(
+            "European", european, today,
+            [&](const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                bool adjoint) -> ext::shared_ptr<PricingEngine> {
+                MakeMCEuropeanEngine_2<PseudoRandom> engine(process);
+                engine.withSteps(timeSteps)
+                    .withSamples(samples)
+                    .withSeed(mcSeed);
+                if (adjoint)
+                    engine.withCurveSensitivities(volatilityNodes);
+                return engine;
+            });
+
+        std::vector<Date> fixingDates = {
+            Date(4, March, 2022), Date(14, March, 2022), Date(24, March, 2022),
+            Date(4, April, 2022), Date(14, April, 2022), Date(24, April, 2022),
+            Date(4, May, 2022), Date(14, May, 2022), Date(24, May, 2022)
+        };
+        DiscreteAveragingAsianOption asian(
+            Average::Arithmetic, 0.0, 0, fixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printCurveSensitivities(
+            "Asian", asian, today,
+            [&](const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                bool adjoint) -> ext::shared_ptr<PricingEngine> {
+                MakeMCDiscreteArithmeticASEngine_2<PseudoRandom> engine(process);
+                engine.withSamples(samples)
+                    .withSeed(mcSeed);
+                if (adjoint)
+                    engine.withCurveSensitivities(volatilityNodes);
+                return engine;
+            });
+
+        // the initial value of the underlying is also a fixing
+        std::vector<Date> todayFixingDates = fixingDates;
+        todayFixingDates.insert(todayFixingDates.begin(), today);
+        DiscreteAveragingAsianOption todayAsian(
+            Average::Arithmetic, 0.0, 0, todayFixingDates,
+            ext::make_shared<PlainVanillaPayoff>(Option::Put, 40),
+            ext::make_shared<EuropeanExercise>(maturity));
+        printCurveSensitivities(
+            "Asian (today)", todayAsian, today,
+            [&](const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                bool adjoint) -> ext::shared_ptr<PricingEngine> {
+                MakeMCDiscreteArithmeticASEngine_2<PseudoRandom> engine(process);
+                engine.withSamples(samples)
+                    .withSeed(mcSeed);
+                if (adjoint)
+                    engine.withCurveSensitivities(volatilityNodes);
+                return engine;
+            });
+
+        std::cout << std::endl;
+    }
+
+}
+
+
+int main(int argc, char* argv[]) {
+
+    try {
+
+        // runs past 2^32 and 10^9 samples take minutes and are opt-in
+        bool longRuns = argc > 1 && std::string(argv[1]) == "--long-runs";
+
+        Date today = Date(24, February, 2022);
+        Settings::instance().evaluationDate() = today;
+
+        auto bsmProcess = makeProcess(today);
+        Date maturity(24, May, 2022);
+
+        profiles(bsmProcess, maturity);
+        earlyTermination(bsmProcess, maturity);
+        importanceSampling(bsmProcess, maturity);
+        controlVariates(bsmProcess, maturity);
+        samplingSchemes(bsmProcess, maturity);
+        fusedKernel(bsmProcess, maturity);
+        specializedPricers(bsmProcess, maturity);
+        seasonedAsians(bsmProcess, maturity);
+        repeatedRepricing(today, maturity);
+        pricingKernels(today, maturity);
+        accumulationPrecision(today, maturity, longRuns);
+        fittedParameters(today);
+        marketSnapshots(today, maturity);
+        shardedSimulation(bsmProcess, maturity);
+        checkpointedSimulation(bsmProcess, maturity);
+        curveSensitivities(today, maturity);
+
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
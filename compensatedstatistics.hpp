@@ -0,0 +1,138 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file compensatedstatistics.hpp
+    \brief Constant-memory accumulator with compensated sums
+*/
+
+#ifndef compensated_statistics_hpp
+#define compensated_statistics_hpp
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace QuantLib {
+
+    //! sum with a running compensation of the rounding errors
+    /*! Uses the Kahan-Babuska-Neumaier variant of compensated
+        summation: the error of each addition is collected in a
+        separate term, also when the added value is larger than the
+        running sum.  The error of the total is of the order of the
+        machine epsilon, independently of the number of terms.
+    */
+    class CompensatedSum {
+      public:
+        CompensatedSum() : sum_(0.0), compensation_(0.0) {}
+        void add(Real x) {
+            Real t = sum_ + x;
+            if (std::fabs(sum_) >= std::fabs(x))
+                compensation_ += (sum_ - t) + x;
+            else
+                compensation_ += (x - t) + sum_;
+            sum_ = t;
+        }
+        void add(const CompensatedSum& other) {
+            add(other.sum_);
+            compensation_ += other.compensation_;
+        }
+        Real value() const { return sum_ + compensation_; }
+      private:
+        Real sum_, compensation_;
+    };
+
+
+    //! accumulator for very long simulations
+    /*! Keeps compensated sums (see CompensatedSum) of the weights and
+        of the weighted first and second powers of the deviations of
+        the samples from the first one, and counts the samples with a
+        64-bit integer.  Shifting the samples keeps the variance from
+        being lost in the cancellation between the two sums when the
+        mean is large compared to the standard deviation.
+
+        Unlike Statistics, which stores every sample, it uses constant
+        memory and its results don't degrade as the number of samples
+        grows; it can be used as the \c S parameter of the engines and
+        simulations in this project for runs of \f$ 10^9 \f$ samples
+        and beyond.  Two accumulators can be merged, e.g., after
+        accumulating the samples of separate threads or processes.
+    */
+    class CompensatedStatistics {
+      public:
+        typedef Real value_type;
+        CompensatedStatistics() : samples_(0), shift_(0.0) {}
+        void add(Real value, Real weight = 1.0);
+        //! adds the samples accumulated in the given accumulator
+        void merge(const CompensatedStatistics& other);
+        void reset() { *this = CompensatedStatistics(); }
+        std::uint64_t samples() const { return samples_; }
+        Real weightSum() const { return weights_.value(); }
+        Real mean() const;
+        Real variance() const;
+        Real standardDeviation() const { return std::sqrt(variance()); }
+        Real errorEstimate() const;
+      private:
+        std::uint64_t samples_;
+        Real shift_;
+        CompensatedSum weights_, deviations_, squaredDeviations_;
+    };
+
+
+    // inline definitions
+
+    inline void CompensatedStatistics::add(Real value, Real weight) {
+        QL_REQUIRE(weight >= 0.0, "negative weight not allowed");
+        if (samples_ == 0)
+            shift_ = value;
+        samples_++;
+        Real d = value - shift_;
+        weights_.add(weight);
+        deviations_.add(weight * d);
+        squaredDeviations_.add(weight * d * d);
+    }
+
+    inline void CompensatedStatistics::merge(
+                                       const CompensatedStatistics& other) {
+        if (other.samples_ == 0)
+            return;
+        if (samples_ == 0) {
+            *this = other;
+            return;
+        }
+        // moves the sums of the other accumulator to our shift
+        Real delta = other.shift_ - shift_;
+        Real w = other.weights_.value(), d = other.deviations_.value();
+        weights_.add(other.weights_);
+        deviations_.add(other.deviations_);
+        deviations_.add(delta * w);
+        squaredDeviations_.add(other.squaredDeviations_);
+        squaredDeviations_.add(2.0 * delta * d);
+        squaredDeviations_.add(delta * delta * w);
+        samples_ += other.samples_;
+    }
+
+    inline Real CompensatedStatistics::mean() const {
+        Real w = weights_.value();
+        QL_REQUIRE(w > 0.0, "no samples accumulated");
+        return shift_ + deviations_.value() / w;
+    }
+
+    inline Real CompensatedStatistics::variance() const {
+        Real w = weights_.value();
+        QL_REQUIRE(w > 0.0, "no samples accumulated");
+        QL_REQUIRE(samples_ > 1, "at least two samples required");
+        Real m = deviations_.value() / w;
+        Real n = static_cast<Real>(samples_);
+        Real v = squaredDeviations_.value() / w - m * m;
+        return n/(n-1.0) * std::max<Real>(v, 0.0);
+    }
+
+    inline Real CompensatedStatistics::errorEstimate() const {
+        return std::sqrt(variance()/static_cast<Real>(samples_));
+    }
+
+}
+
+
+#endif
@@ -1,3 +1,108 @@
 
 #include "constantblackscholesprocess.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace QuantLib {
+
+    ConstantBlackScholesProcess::ConstantBlackScholesProcess(
+                                                  Real x0,
+                                                  Rate riskFreeRate,
+                                                  Rate dividendYield,
+                                                  Volatility volatility)
+    : x0_(x0), riskFreeRate_(riskFreeRate), dividendYield_(dividendYield),
+      volatility_(volatility) {
+        QL_REQUIRE(volatility >= 0.0,
+                   "negative volatility (" << volatility << ") given");
+    }
+
+    ConstantBlackScholesProcess::ConstantBlackScholesProcess(
+            const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+            const Date& date,
+            Real strike) {
+        QL_REQUIRE(process, "null Black-Scholes process");
+        // the rates use the day counter of the risk-free curve, which is
+        // the one used by the process to convert dates into times
+        DayCounter dayCounter = process->riskFreeRate()->dayCounter();
+        x0_ = process->x0();
+        riskFreeRate_ =
+            process->riskFreeRate()->zeroRate(date, dayCounter, Continuous,
+                                              NoFrequency, true);
+        dividendYield_ =
+            process->dividendYield()->zeroRate(date, dayCounter, Continuous,
+                                               NoFrequency, true);
+        volatility_ = process->blackVolatility()->blackVol(date, strike, true);
+    }
+
+    ConstantBlackScholesProcess::ConstantBlackScholesProcess(
+            const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+            const std::vector<Time>& times,
+            const Date& paymentDate,
+            Real strike) {
+        QL_REQUIRE(process, "null Black-Scholes process");
+        DayCounter dayCounter = process->riskFreeRate()->dayCounter();
+        x0_ = process->x0();
+        riskFreeRate_ =
+            process->riskFreeRate()->zeroRate(paymentDate, dayCounter,
+                                              Continuous, NoFrequency, true);
+        // least-squares fits through the origin of the integrated
+        // drift and variance
+        Real sumT2 = 0.0, sumTDrift = 0.0, sumTVariance = 0.0;
+        for (Time t : times) {
+            if (t <= 0.0)
+                continue;
+            Real logForward =
+                std::log(process->dividendYield()->discount(t, true) /
+                         process->riskFreeRate()->discount(t, true));
+            Real variance =
+                process->blackVolatility()->blackVariance(t, strike, true);
+            sumT2 += t*t;
+            sumTDrift += t*logForward;
+            sumTVariance += t*variance;
+        }
+        QL_REQUIRE(sumT2 > 0.0, "no positive times given");
+        dividendYield_ = riskFreeRate_ - sumTDrift/sumT2;
+        volatility_ = std::sqrt(std::max<Real>(sumTVariance/sumT2, 0.0));
+    }
+
+    Real ConstantBlackScholesProcess::x0() const {
+        return x0_;
+    }
+
+    Real ConstantBlackScholesProcess::drift(Time, Real) const {
+        return riskFreeRate_ - dividendYield_ - 0.5*volatility_*volatility_;
+    }
+
+    Real ConstantBlackScholesProcess::diffusion(Time, Real) const {
+        return volatility_;
+    }
+
+    Real ConstantBlackScholesProcess::apply(Real x0, Real dx) const {
+        return x0 * std::exp(dx);
+    }
+
+    Real ConstantBlackScholesProcess::expectation(Time, Real x0,
+                                                  Time dt) const {
+        return x0 * std::exp((riskFreeRate_ - dividendYield_)*dt);
+    }
+
+    Real ConstantBlackScholesProcess::stdDeviation(Time, Real,
+                                                   Time dt) const {
+        return volatility_ * std::sqrt(dt);
+    }
+
+    Real ConstantBlackScholesProcess::variance(Time, Real, Time dt) const {
+        return volatility_ * volatility_ * dt;
+    }
+
+    Real ConstantBlackScholesProcess::evolve(Time t0, Real x0,
+                                             Time dt, Real dw) const {
+        return apply(x0, drift(t0, x0)*dt + stdDeviation(t0, x0, dt)*dw);
+    }
+
+    DiscountFactor ConstantBlackScholesProcess::discount(Time t) const {
+        return std::exp(-riskFreeRate_*t);
+    }
+
+}
 
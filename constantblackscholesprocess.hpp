@@ -1,13 +1,82 @@
 
+#ifndef constant_black_scholes_process_hpp
+#define constant_black_scholes_process_hpp
+
 #include <ql/stochasticprocess.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <vector>
 
 namespace QuantLib {
 
-    class ConstantBlackScholesProcess : public StochasticProcess1D {
+    //! Black-Scholes process with constant parameters
+    /*! This class describes the stochastic process \f$ S \f$ governed by
+        \f[
+            d\ln S(t) = (r - q - \frac{\sigma^2}{2}) dt + \sigma dW_t
+        \f]
+        with constant risk-free rate \f$ r \f$, dividend yield \f$ q \f$
+        and volatility \f$ \sigma \f$.
 
-        // your implementation goes here
-        
+        As in GeneralizedBlackScholesProcess, drift and diffusion refer
+        to the logarithm of the underlying; evolve() uses the exact
+        log-normal step, so no discretization error is introduced.
+    */
+    class ConstantBlackScholesProcess : public StochasticProcess1D {
+      public:
+        ConstantBlackScholesProcess(Real x0,
+                                    Rate riskFreeRate,
+                                    Rate dividendYield,
+                                    Volatility volatility);
+        /*! extracts the constant parameters from the given process:
+            the rates are the continuous zero rates of the risk-free
+            and dividend curves at the given date, the volatility is
+            the Black volatility at the same date and strike.
+        */
+        ConstantBlackScholesProcess(
+            const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+            const Date& date,
+            Real strike);
+        /*! fits the constant parameters to the given process over the
+            given times, e.g., the fixing times of an Asian.  The
+            risk-free rate is the
+            continuous zero rate at the payment date, so that the
+            payoff is discounted exactly; the drift \f$ r - q \f$ and
+            the variance \f$ \sigma^2 \f$ are the least-squares fits
+            of the log-forwards \f$ \ln F(t_i)/S_0 \f$ and of the Black
+            variances \f$ \sigma_B^2(t_i,K) t_i \f$, which are linear
+            in \f$ t_i \f$ for constant parameters.  Non-positive times
+            are ignored.  With the payment time alone, the result is
+            the same as with the constructor above.
+        */
+        ConstantBlackScholesProcess(
+            const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+            const std::vector<Time>& times,
+            const Date& paymentDate,
+            Real strike);
+        //! \name StochasticProcess1D interface
+        //@{
+        Real x0() const override;
+        Real drift(Time t, Real x) const override;
+        Real diffusion(Time t, Real x) const override;
+        Real apply(Real x0, Real dx) const override;
+        Real expectation(Time t0, Real x0, Time dt) const override;
+        Real stdDeviation(Time t0, Real x0, Time dt) const override;
+        Real variance(Time t0, Real x0, Time dt) const override;
+        Real evolve(Time t0, Real x0, Time dt, Real dw) const override;
+        //@}
+        //! \name Inspectors
+        //@{
+        Rate riskFreeRate() const { return riskFreeRate_; }
+        Rate dividendYield() const { return dividendYield_; }
+        Volatility volatility() const { return volatility_; }
+        DiscountFactor discount(Time t) const;
+        //@}
+      private:
+        Real x0_;
+        Rate riskFreeRate_, dividendYield_;
+        Volatility volatility_;
     };
 
 }
 
+
+#endif
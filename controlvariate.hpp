@@ -0,0 +1,196 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file controlvariate.hpp
+    \brief Control variate with coefficient estimated during the simulation
+*/
+
+#ifndef control_variate_hpp
+#define control_variate_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include "mceuropeanengine.hpp"
+#include "samplecontrol.hpp"
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathgenerator.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/pricingengines/blackformula.hpp>
+#include <cmath>
+#include <utility>
+
+namespace QuantLib {
+
+    //! accumulator for a sample and its control
+    /*! Keeps the running means, variances and covariance of the
+        samples \f$ Y \f$ and of the controls \f$ X \f$, updated as in
+        Welford's algorithm.  Given the exact expectation \f$ \mu_X \f$
+        of the control, the controlled estimate is
+        \f[
+            \bar{Y} - \beta (\bar{X} - \mu_X), \qquad
+            \beta = \frac{\mathrm{Cov}(X,Y)}{\mathrm{Var}(X)}
+        \f]
+        where \f$ \beta \f$ is estimated from the same samples, i.e.,
+        on the fly; the resulting bias is of order \f$ 1/N \f$ and is
+        negligible in practice.
+    */
+    class ControlVariateAccumulator {
+      public:
+        ControlVariateAccumulator()
+        : samples_(0), mean_(0.0), controlMean_(0.0), variance_(0.0),
+          controlVariance_(0.0), covariance_(0.0) {}
+        void add(Real value, Real control);
+        Size samples() const { return samples_; }
+        //! the optimal coefficient \f$ \beta \f$ estimated so far
+        Real coefficient() const;
+        //! the controlled estimate
+        Real mean(Real controlValue) const;
+        //! the error estimate of the controlled estimate
+        Real errorEstimate() const;
+        //! the ratio between the plain and the controlled variances
+        Real varianceReduction() const;
+      private:
+        Real residualVariance() const;
+        Size samples_;
+        Real mean_, controlMean_;
+        // sums of squared deviations and of cross products
+        Real variance_, controlVariance_, covariance_;
+    };
+
+
+    //! Monte Carlo simulation of a path pricer and its control
+    /*! Each path is priced by both pricers; with antithetic
+        variates, the values and the controls are averaged over the
+        two paths before being accumulated.  The number of samples is
+        driven by simulateToTarget().
+    */
+    template <class RNG>
+    class ControlVariateSimulation {
+      public:
+        typedef PathGenerator<typename RNG::rsg_type> path_generator_type;
+        ControlVariateSimulation(
+                           ext::shared_ptr<path_generator_type> generator,
+                           ext::shared_ptr<PathPricer<Path> > pricer,
+                           ext::shared_ptr<PathPricer<Path> > controlPricer,
+                           Real controlValue,
+                           bool antitheticVariate);
+        void calculate(Real requiredTolerance,
+                       Size requiredSamples,
+                       Size maxSamples);
+        void addSamples(Size samples);
+        Size samples() const { return accumulator_.samples(); }
+        Real errorEstimate() const { return accumulator_.errorEstimate(); }
+        Real value() const { return accumulator_.mean(controlValue_); }
+        const ControlVariateAccumulator& accumulator() const {
+            return accumulator_;
+        }
+      private:
+        ext::shared_ptr<path_generator_type> generator_;
+        ext::shared_ptr<PathPricer<Path> > pricer_, controlPricer_;
+        Real controlValue_;
+        bool antitheticVariate_;
+        ControlVariateAccumulator accumulator_;
+    };
+
+
+    //! plain vanilla on the terminal value of the path, and its price
+    /*! The control pays the discounted vanilla payoff on the last
+        value of the path; for paths sampled from the given constant
+        process, its exact expectation is the Black price with the
+        forward and variance of the process at the given maturity.
+    */
+    inline std::pair<ext::shared_ptr<PathPricer<Path> >, Real>
+    terminalVanillaControl(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  Option::Type type,
+                  Real strike,
+                  Time maturity,
+                  DiscountFactor discount) {
+        ext::shared_ptr<PathPricer<Path> > pricer =
+            dispatchOptionType(type,
+                               detail::EuropeanPathPricerFactory(strike,
+                                                                 discount));
+        Real forward = process->expectation(0.0, process->x0(), maturity);
+        Real stdDev = process->stdDeviation(0.0, process->x0(), maturity);
+        Real value = blackFormula(type, strike, forward, stdDev, discount);
+        return std::make_pair(pricer, value);
+    }
+
+
+    // inline definitions
+
+    inline void ControlVariateAccumulator::add(Real value, Real control) {
+        ++samples_;
+        Real n = static_cast<Real>(samples_);
+        Real dx = control - controlMean_;
+        Real dy = value - mean_;
+        controlMean_ += dx/n;
+        mean_ += dy/n;
+        controlVariance_ += dx*(control - controlMean_);
+        variance_ += dy*(value - mean_);
+        covariance_ += dx*(value - mean_);
+    }
+
+    inline Real ControlVariateAccumulator::coefficient() const {
+        return controlVariance_ > 0.0 ? covariance_/controlVariance_ : 0.0;
+    }
+
+    inline Real ControlVariateAccumulator::mean(Real controlValue) const {
+        QL_REQUIRE(samples_ > 0, "no samples accumulated");
+        return mean_ - coefficient()*(controlMean_ - controlValue);
+    }
+
+    inline Real ControlVariateAccumulator::residualVariance() const {
+        QL_REQUIRE(samples_ > 1, "at least two samples required");
+        Real residual = variance_ - coefficient()*covariance_;
+        return std::max<Real>(residual, 0.0) / (samples_ - 1.0);
+    }
+
+    inline Real ControlVariateAccumulator::errorEstimate() const {
+        return std::sqrt(residualVariance()/samples_);
+    }
+
+    inline Real ControlVariateAccumulator::varianceReduction() const {
+        Real residual = residualVariance();
+        return residual > 0.0 ? variance_/(samples_ - 1.0)/residual
+                              : Null<Real>();
+    }
+
+
+    template <class RNG>
+    inline ControlVariateSimulation<RNG>::ControlVariateSimulation(
+                           ext::shared_ptr<path_generator_type> generator,
+                           ext::shared_ptr<PathPricer<Path> > pricer,
+                           ext::shared_ptr<PathPricer<Path> > controlPricer,
+                           Real controlValue,
+                           bool antitheticVariate)
+    : generator_(std::move(generator)), pricer_(std::move(pricer)),
+      controlPricer_(std::move(controlPricer)), controlValue_(controlValue),
+      antitheticVariate_(antitheticVariate) {}
+
+    template <class RNG>
+    inline void ControlVariateSimulation<RNG>::calculate(
+                                                     Real requiredTolerance,
+                                                     Size requiredSamples,
+                                                     Size maxSamples) {
+        simulateToTarget(*this, requiredTolerance, requiredSamples,
+                         maxSamples);
+    }
+
+    template <class RNG>
+    inline void ControlVariateSimulation<RNG>::addSamples(Size samples) {
+        for (Size j=0; j<samples; j++) {
+            const Path& path = generator_->next().value;
+            Real value = (*pricer_)(path);
+            Real control = (*controlPricer_)(path);
+            if (antitheticVariate_) {
+                const Path& antitheticPath = generator_->antithetic().value;
+                value = (value + (*pricer_)(antitheticPath))/2.0;
+                control = (control + (*controlPricer_)(antitheticPath))/2.0;
+            }
+            accumulator_.add(value, control);
+        }
+    }
+
+}
+
+
+#endif
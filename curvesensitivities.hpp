@@ -0,0 +1,311 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file curvesensitivities.hpp
+    \brief Adjoint sensitivities to the nodes of the rate and volatility curves
+*/
+
+#ifndef curve_sensitivities_hpp
+#define curve_sensitivities_hpp
+
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
+#include <ql/termstructures/volatility/equityfx/blackvariancecurve.hpp>
+#include <ql/termstructures/yield/zerocurve.hpp>
+#include <ql/timegrid.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Path pricer accumulating adjoint sensitivities to the curves
+    /*! Paths are assumed to be generated from the given process with
+        its exact log-normal step, i.e.,
+        \f[
+            \ln S_{i+1} = \ln S_i + \ln\frac{D_i}{D_{i+1}}
+                        - \ln\frac{Q_i}{Q_{i+1}}
+                        - \frac{1}{2}(W_{i+1} - W_i)
+                        + \sqrt{W_{i+1} - W_i}\, z_i
+        \f]
+        where \f$ D_i \f$ and \f$ Q_i \f$ are the risk-free and
+        dividend discounts and \f$ W_i \f$ the Black variance at the
+        grid times.  This is the step taken by the process when its
+        volatility doesn't depend on the strike, e.g., for a
+        BlackVarianceCurve.
+
+        For each path, the derived class returns the payoff and its
+        gradient with respect to the values of the path.  The
+        discounted gradient is then propagated backwards through the
+        steps, recovering each \f$ z_i \f$ from the path, and the
+        derivatives of the discounted payoff with respect to each
+        \f$ \ln D_i \f$ and \f$ W_i \f$ are accumulated; thus, the
+        sensitivities to all the curve inputs are obtained from a
+        single simulation, at a cost comparable to that of the pricing.
+        The discount applied to the payoff is taken at a separate time,
+        which need not be on the grid.
+
+        The derivatives are pathwise, and thus require a payoff which
+        is continuous in the path values.
+    */
+    class CurveAdjointPathPricer : public PathPricer<Path> {
+      public:
+        CurveAdjointPathPricer(
+                 const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                 const TimeGrid& grid,
+                 Time discountTime);
+        Real operator()(const Path& path) const override;
+        //! the number of priced paths
+        Size paths() const { return paths_; }
+        //! the grid times, followed by the discount time
+        const std::vector<Time>& rateTimes() const { return rateTimes_; }
+        //! the grid times
+        const std::vector<Time>& varianceTimes() const {
+            return varianceTimes_;
+        }
+        //! average sensitivities to the log-discounts at the rate times
+        std::vector<Real> logDiscountSensitivities() const;
+        //! average sensitivities to the Black variances at the grid times
+        std::vector<Real> varianceSensitivities() const;
+      protected:
+        //! returns the payoff and fills its gradient
+        virtual Real payoff(const Path& path,
+                            std::vector<Real>& gradient) const = 0;
+      private:
+        std::vector<Time> rateTimes_, varianceTimes_;
+        DiscountFactor discount_;
+        std::vector<Real> drifts_, stdDevs_;
+        mutable std::vector<Real> gradient_;
+        mutable std::vector<Real> logDiscountSums_, varianceSums_;
+        mutable Size paths_;
+    };
+
+
+    //! sensitivities to the zero rates at the nodes of a linear ZeroCurve
+    /*! Given the sensitivities to the log-discounts at the given
+        times, returns those to the zero rate at each node of the
+        curve, which is linearly interpolated in the zero rates between
+        nodes, flat before the first one and extrapolated with a flat
+        forward after the last one.
+    */
+    std::vector<Real> zeroCurveNodeSensitivities(
+                            const std::vector<Time>& nodeTimes,
+                            const std::vector<Time>& times,
+                            const std::vector<Real>& logDiscountSensitivities);
+
+    //! sensitivities to the volatilities at the nodes of a BlackVarianceCurve
+    /*! Given the sensitivities to the Black variances at the given
+        times, returns those to the Black volatility at each of the
+        given node dates.  The curve is assumed to interpolate the
+        variance linearly in time between its nodes and the null
+        variance at the reference date, and to extrapolate it linearly
+        from the reference date after the last node.  The node
+        volatilities are read from the curve itself.
+    */
+    std::vector<Real> varianceCurveNodeSensitivities(
+                                const BlackVolTermStructure& curve,
+                                const std::vector<Date>& nodeDates,
+                                const std::vector<Time>& times,
+                                const std::vector<Real>& varianceSensitivities);
+
+    //! stores the node sensitivities in the engine results
+    /*! The sensitivities to the zero rates at the nodes of the
+        risk-free curve, which must be a ZeroCurve, are stored as the
+        \c zeroRateSensitivities additional result; those to the
+        volatilities at the given dates as \c volatilitySensitivities.
+        The volatility must be a BlackVarianceCurve or a
+        BlackConstantVol, so that the process takes the exact step
+        assumed by the adjoint.
+        Both are stored as \c std::vector<Real>.
+    */
+    template <class Results>
+    void storeCurveSensitivities(const CurveAdjointPathPricer& pricer,
+                                 const GeneralizedBlackScholesProcess& process,
+                                 const std::vector<Date>& volatilityNodes,
+                                 Results& results) {
+        ext::shared_ptr<ZeroCurve> curve =
+            ext::dynamic_pointer_cast<ZeroCurve>(
+                process.riskFreeRate().currentLink());
+        QL_REQUIRE(curve, "curve sensitivities require a ZeroCurve");
+        // the adjoint assumes the exact, strike-independent step
+        const ext::shared_ptr<BlackVolTermStructure>& volatility =
+            process.blackVolatility().currentLink();
+        QL_REQUIRE(ext::dynamic_pointer_cast<BlackVarianceCurve>(volatility) ||
+                   ext::dynamic_pointer_cast<BlackConstantVol>(volatility),
+                   "curve sensitivities require a BlackVarianceCurve "
+                   "or a BlackConstantVol");
+        results.additionalResults["zeroRateSensitivities"] =
+            zeroCurveNodeSensitivities(curve->times(), pricer.rateTimes(),
+                                       pricer.logDiscountSensitivities());
+        results.additionalResults["volatilitySensitivities"] =
+            varianceCurveNodeSensitivities(**process.blackVolatility(),
+                                           volatilityNodes,
+                                           pricer.varianceTimes(),
+                                           pricer.varianceSensitivities());
+    }
+
+
+    // inline definitions
+
+    inline CurveAdjointPathPricer::CurveAdjointPathPricer(
+                 const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                 const TimeGrid& grid,
+                 Time discountTime)
+    : rateTimes_(grid.begin(), grid.end()),
+      varianceTimes_(grid.begin(), grid.end()),
+      discount_(process->riskFreeRate()->discount(discountTime)),
+      drifts_(grid.size()-1), stdDevs_(grid.size()-1),
+      gradient_(grid.size()), logDiscountSums_(grid.size()+1, 0.0),
+      varianceSums_(grid.size(), 0.0), paths_(0) {
+        QL_REQUIRE(grid.size() > 1, "the time grid cannot be empty");
+        rateTimes_.push_back(discountTime);
+        for (Size i=0; i<grid.size()-1; i++) {
+            // the same quantities used by the exact step of the process
+            Real variance =
+                process->blackVolatility()->blackVariance(grid[i+1], 0.01,
+                                                          true)
+                - process->blackVolatility()->blackVariance(grid[i], 0.01,
+                                                            true);
+            drifts_[i] =
+                std::log(process->riskFreeRate()->discount(grid[i]) /
+                         process->riskFreeRate()->discount(grid[i+1]))
+                - std::log(process->dividendYield()->discount(grid[i]) /
+                           process->dividendYield()->discount(grid[i+1]))
+                - 0.5*variance;
+            stdDevs_[i] = std::sqrt(variance);
+        }
+    }
+
+    inline Real CurveAdjointPathPricer::operator()(const Path& path) const {
+        Size n = path.length();
+        QL_REQUIRE(n == gradient_.size(), "path not on the expected grid");
+        std::fill(gradient_.begin(), gradient_.end(), 0.0);
+        Real value = discount_ * payoff(path, gradient_);
+
+        // adjoint of the log-value, summed over the following nodes
+        Real adjoint = 0.0;
+        for (Size i=n-1; i>0; i--) {
+            adjoint += discount_ * gradient_[i] * path[i];
+            logDiscountSums_[i-1] += adjoint;
+            logDiscountSums_[i] -= adjoint;
+            Real stdDev = stdDevs_[i-1];
+            if (stdDev > 0.0) {
+                Real z = (std::log(path[i]/path[i-1]) - drifts_[i-1]) / stdDev;
+                Real varianceAdjoint = adjoint * (0.5*z/stdDev - 0.5);
+                varianceSums_[i] += varianceAdjoint;
+                varianceSums_[i-1] -= varianceAdjoint;
+            }
+        }
+        logDiscountSums_.back() += value;
+        ++paths_;
+        return value;
+    }
+
+    inline std::vector<Real>
+    CurveAdjointPathPricer::logDiscountSensitivities() const {
+        QL_REQUIRE(paths_ > 0, "no paths priced");
+        std::vector<Real> result(logDiscountSums_);
+        for (Real& x : result)
+            x /= paths_;
+        return result;
+    }
+
+    inline std::vector<Real>
+    CurveAdjointPathPricer::varianceSensitivities() const {
+        QL_REQUIRE(paths_ > 0, "no paths priced");
+        std::vector<Real> result(varianceSums_);
+        for (Real& x : result)
+            x /= paths_;
+        return result;
+    }
+
+
+    inline std::vector<Real> zeroCurveNodeSensitivities(
+                           const std::vector<Time>& nodeTimes,
+                           const std::vector<Time>& times,
+                           const std::vector<Real>& logDiscountSensitivities) {
+        Size m = nodeTimes.size();
+        QL_REQUIRE(m > 1, "at least two nodes required");
+        QL_REQUIRE(times.size() == logDiscountSensitivities.size(),
+                   "wrong number of sensitivities");
+        std::vector<Real> result(m, 0.0);
+        for (Size k=0; k<times.size(); k++) {
+            Time t = times[k];
+            // ln D(t) = -z(t) t
+            Real factor = -t * logDiscountSensitivities[k];
+            if (t == 0.0 || factor == 0.0)
+                continue;
+            if (t <= nodeTimes.front()) {
+                result.front() += factor;
+            } else if (t <= nodeTimes.back()) {
+                Size i = std::upper_bound(nodeTimes.begin(), nodeTimes.end(),
+                                          t) - nodeTimes.begin() - 1;
+                i = std::min(i, m-2);
+                Real w = (t - nodeTimes[i])/(nodeTimes[i+1] - nodeTimes[i]);
+                result[i] += factor * (1.0 - w);
+                result[i+1] += factor * w;
+            } else {
+                // z(t) = (z_m t_m + f_m (t - t_m))/t, with the forward
+                // f_m extrapolated from the slope of the last segment
+                Time tm = nodeTimes[m-1];
+                Time h = tm - nodeTimes[m-2];
+                result[m-1] += factor * (tm + (1.0 + tm/h)*(t - tm)) / t;
+                result[m-2] += factor * (-tm/h*(t - tm)) / t;
+            }
+        }
+        return result;
+    }
+
+    inline std::vector<Real> varianceCurveNodeSensitivities(
+                               const BlackVolTermStructure& curve,
+                               const std::vector<Date>& nodeDates,
+                               const std::vector<Time>& times,
+                               const std::vector<Real>& varianceSensitivities) {
+        QL_REQUIRE(times.size() == varianceSensitivities.size(),
+                   "wrong number of sensitivities");
+        Size m = nodeDates.size();
+        if (m == 0)
+            return std::vector<Real>();
+        // the reference date is a node with null variance
+        std::vector<Time> nodeTimes(m+1, 0.0);
+        for (Size j=0; j<m; j++)
+            nodeTimes[j+1] = curve.timeFromReference(nodeDates[j]);
+        QL_REQUIRE(std::is_sorted(nodeTimes.begin(), nodeTimes.end()) &&
+                   std::adjacent_find(nodeTimes.begin(),
+                                      nodeTimes.end()) == nodeTimes.end(),
+                   "node dates must be increasing and after the reference");
+
+        // sensitivities to the node variances first
+        std::vector<Real> result(m+1, 0.0);
+        for (Size k=0; k<times.size(); k++) {
+            Time t = times[k];
+            if (t <= 0.0)
+                continue;
+            if (t <= nodeTimes.back()) {
+                Size i = std::upper_bound(nodeTimes.begin(), nodeTimes.end(),
+                                          t) - nodeTimes.begin() - 1;
+                i = std::min(i, m-1);
+                Real w = (t - nodeTimes[i])/(nodeTimes[i+1] - nodeTimes[i]);
+                result[i] += varianceSensitivities[k] * (1.0 - w);
+                result[i+1] += varianceSensitivities[k] * w;
+            } else {
+                result[m] += varianceSensitivities[k] * t/nodeTimes.back();
+            }
+        }
+
+        // then to the volatilities, since v_j = t_j sigma_j^2
+        result.erase(result.begin());
+        for (Size j=0; j<m; j++) {
+            Time tj = nodeTimes[j+1];
+            Volatility sigma =
+                std::sqrt(curve.blackVariance(tj, 0.01, true)/tj);
+            result[j] *= 2.0*tj*sigma;
+        }
+        return result;
+    }
+
+}
+
+
+#endif
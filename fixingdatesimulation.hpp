@@ -0,0 +1,231 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file fixingdatesimulation.hpp
+    \brief Simulation of average-strike Asian options on their fixing dates
+*/
+
+#ifndef fixing_date_simulation_hpp
+#define fixing_date_simulation_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include "samplecontrol.hpp"
+#include <ql/math/statistics/statistics.hpp>
+#include <ql/methods/montecarlo/brownianbridge.hpp>
+#include <ql/option.hpp>
+#include <ql/timegrid.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Monte Carlo simulation of average-strike Asians on their fixing dates
+    /*! The underlying is simulated only at the nodes of the given
+        grid, which should contain the fixing times and nothing else.
+        With constant parameters, the log-normal step between two
+        nodes is exact, so no intermediate steps are needed; its drift
+        and diffusion terms are computed once for the whole simulation.
+        The logarithm of the underlying is obtained at all nodes by a
+        cumulative sum of the increments, and exponentiated only at
+        the nodes where an option fixes.
+
+        Any number of arithmetic average-strike options can be added,
+        each fixing on a subset of the nodes and possibly seasoned,
+        i.e., with a running sum of past fixings.  Each path updates
+        the running sums and, at the last fixing of each option, its
+        payoff in place; no Path is built.  All options share the same
+        paths, so a book of partially fixed Asians on the same
+        underlying is priced with one simulation.
+
+        As in ArithmeticASOPathPricer, the payoff is evaluated on the
+        value of the underlying at the last fixing and the strike is
+        the average of the past and simulated fixings.  The sequence
+        of random numbers, including the Brownian-bridge and
+        antithetic variants, is the same used by PathGenerator; thus,
+        the results for a single option are the same that would be
+        obtained by a path generator with the same process and grid.
+    */
+    template <class RNG = PseudoRandom, class S = Statistics>
+    class FixingDateSimulation {
+      public:
+        typedef S stats_type;
+        FixingDateSimulation(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  const TimeGrid& grid,
+                  bool brownianBridge,
+                  bool antitheticVariate,
+                  BigNatural seed);
+        /*! adds an average-strike option fixing at the given nodes of
+            the grid and returns its index.
+        */
+        Size add(Option::Type type,
+                 DiscountFactor discount,
+                 Real runningAccumulator,
+                 Size pastFixings,
+                 const std::vector<Size>& fixingNodes);
+        void calculate(Real requiredTolerance,
+                       Size requiredSamples,
+                       Size maxSamples);
+        void addSamples(Size samples);
+        //! number of options
+        Size size() const { return types_.size(); }
+        const stats_type& sampleAccumulator(Size i) const {
+            return accumulators_.at(i);
+        }
+        Size samples() const;
+        //! largest error estimate among the options
+        Real errorEstimate() const;
+      private:
+        void simulatePath(const std::vector<Real>& variates, bool antithetic);
+        TimeGrid grid_;
+        bool brownianBridge_, antitheticVariate_;
+        typename RNG::rsg_type generator_;
+        BrownianBridge bridge_;
+        Real x0_;
+        std::vector<Real> drift_, diffusion_;
+        // options
+        std::vector<Option::Type> types_;
+        std::vector<DiscountFactor> discounts_;
+        std::vector<Real> runningSums_;
+        std::vector<Size> fixings_;
+        std::vector<std::vector<Size> > fixingsAt_, lastFixingAt_;
+        std::vector<stats_type> accumulators_;
+        // path state
+        std::vector<Real> variates_, logValues_, sums_, values_,
+            antitheticValues_;
+    };
+
+
+    // template definitions
+
+    template <class RNG, class S>
+    inline FixingDateSimulation<RNG,S>::FixingDateSimulation(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  const TimeGrid& grid,
+                  bool brownianBridge,
+                  bool antitheticVariate,
+                  BigNatural seed)
+    : grid_(grid), brownianBridge_(brownianBridge),
+      antitheticVariate_(antitheticVariate),
+      generator_(RNG::make_sequence_generator(grid.size()-1, seed)),
+      bridge_(grid), x0_(process->x0()),
+      drift_(grid.size()-1), diffusion_(grid.size()-1),
+      fixingsAt_(grid.size()), lastFixingAt_(grid.size()),
+      variates_(grid.size()-1), logValues_(grid.size()) {
+        QL_REQUIRE(grid.size() > 1, "the time grid cannot be empty");
+        for (Size i=0; i<grid.size()-1; i++) {
+            // the same terms used by ConstantBlackScholesProcess::evolve
+            drift_[i] = process->drift(grid[i], x0_) * grid.dt(i);
+            diffusion_[i] = process->stdDeviation(grid[i], x0_, grid.dt(i));
+        }
+    }
+
+    template <class RNG, class S>
+    inline Size FixingDateSimulation<RNG,S>::add(
+                                     Option::Type type,
+                                     DiscountFactor discount,
+                                     Real runningAccumulator,
+                                     Size pastFixings,
+                                     const std::vector<Size>& fixingNodes) {
+        QL_REQUIRE(samples() == 0,
+                   "options cannot be added after the simulation started");
+        QL_REQUIRE(!fixingNodes.empty(), "no future fixings given");
+        QL_REQUIRE(std::is_sorted(fixingNodes.begin(), fixingNodes.end()),
+                   "fixing nodes must be sorted");
+        QL_REQUIRE(fixingNodes.back() < grid_.size(),
+                   "fixing node (" << fixingNodes.back()
+                   << ") outside the time grid");
+
+        Size i = types_.size();
+        types_.push_back(type);
+        discounts_.push_back(discount);
+        runningSums_.push_back(runningAccumulator);
+        fixings_.push_back(pastFixings + fixingNodes.size());
+        for (Size node : fixingNodes)
+            fixingsAt_[node].push_back(i);
+        lastFixingAt_[fixingNodes.back()].push_back(i);
+        accumulators_.push_back(stats_type());
+        sums_.push_back(0.0);
+        values_.push_back(0.0);
+        antitheticValues_.push_back(0.0);
+        return i;
+    }
+
+    template <class RNG, class S>
+    inline void FixingDateSimulation<RNG,S>::calculate(Real requiredTolerance,
+                                                       Size requiredSamples,
+                                                       Size maxSamples) {
+        QL_REQUIRE(!types_.empty(), "no options to simulate");
+        simulateToTarget(*this, requiredTolerance, requiredSamples,
+                         maxSamples);
+    }
+
+    template <class RNG, class S>
+    inline void FixingDateSimulation<RNG,S>::addSamples(Size samples) {
+        for (Size j=0; j<samples; j++) {
+            const std::vector<Real>& sequence =
+                generator_.nextSequence().value;
+            if (brownianBridge_)
+                bridge_.transform(sequence.begin(), sequence.end(),
+                                  variates_.begin());
+            else
+                std::copy(sequence.begin(), sequence.end(),
+                          variates_.begin());
+
+            simulatePath(variates_, false);
+            if (antitheticVariate_) {
+                std::swap(values_, antitheticValues_);
+                simulatePath(variates_, true);
+                for (Size k=0; k<values_.size(); k++)
+                    accumulators_[k].add(
+                        (antitheticValues_[k]+values_[k])/2.0, 1.0);
+            } else {
+                for (Size k=0; k<values_.size(); k++)
+                    accumulators_[k].add(values_[k], 1.0);
+            }
+        }
+    }
+
+    template <class RNG, class S>
+    inline void FixingDateSimulation<RNG,S>::simulatePath(
+                                          const std::vector<Real>& variates,
+                                          bool antithetic) {
+        std::fill(sums_.begin(), sums_.end(), 0.0);
+        Real sign = antithetic ? -1.0 : 1.0;
+        logValues_[0] = std::log(x0_);
+        for (Size node=1; node<grid_.size(); node++)
+            logValues_[node] = logValues_[node-1] + drift_[node-1]
+                             + diffusion_[node-1]*(sign*variates[node-1]);
+        for (Size node=0; node<grid_.size(); node++) {
+            if (fixingsAt_[node].empty() && lastFixingAt_[node].empty())
+                continue;
+            Real x = node == 0 ? x0_ : std::exp(logValues_[node]);
+            for (Size k : fixingsAt_[node])
+                sums_[k] += x;
+            for (Size k : lastFixingAt_[node]) {
+                Real averageStrike = (runningSums_[k] + sums_[k])/fixings_[k];
+                values_[k] = discounts_[k] *
+                    (types_[k] == Option::Call ?
+                     std::max<Real>(x - averageStrike, 0.0) :
+                     std::max<Real>(averageStrike - x, 0.0));
+            }
+        }
+    }
+
+    template <class RNG, class S>
+    inline Size FixingDateSimulation<RNG,S>::samples() const {
+        return accumulators_.empty() ? 0 : accumulators_.front().samples();
+    }
+
+    template <class RNG, class S>
+    inline Real FixingDateSimulation<RNG,S>::errorEstimate() const {
+        Real error = 0.0;
+        for (const stats_type& accumulator : accumulators_)
+            error = std::max(error, accumulator.errorEstimate());
+        return error;
+    }
+
+}
+
+
+#endif
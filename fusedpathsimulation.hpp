@@ -0,0 +1,171 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file fusedpathsimulation.hpp
+    \brief Simulation evolving the underlying and the pricer state together
+*/
+
+#ifndef fused_path_simulation_hpp
+#define fused_path_simulation_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include "lazypathsimulation.hpp"
+#include "samplecontrol.hpp"
+#include <ql/math/statistics/statistics.hpp>
+#include <ql/methods/montecarlo/brownianbridge.hpp>
+#include <ql/timegrid.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Monte Carlo simulation fusing path generation and pricing
+    /*! For each path, the logarithm of the underlying is evolved with
+        the exact step of the given constant process, whose drift and
+        diffusion terms are computed once for the whole grid, and each
+        new value is passed to the step pricer (see \ref steppricers)
+        through its logStep() method as soon as it is computed.  The
+        increments of all the steps are computed together in a loop
+        without transcendental calls, which the compiler can
+        vectorize; the steps themselves only need an addition, and
+        the underlying is exponentiated once, when the payoff is
+        evaluated.  The pricer keeps the state it needs (e.g., the
+        barrier status) and no Path is built; the only storage used
+        per path is the random sequence and its increments.
+
+        A local copy of the pricer is used during the simulation, so
+        that its state can be kept in registers; the pricer is not
+        called through a virtual interface.  When the pricer returns
+        PathStatus::Finished, the rest of the path is skipped; when it
+        returns PathStatus::TerminalOnly, the underlying is evolved to
+        maturity without calling it further.
+
+        The random sequences, including the Brownian-bridge and
+        antithetic variants, are the same used by PathGenerator with
+        the same generator; thus, the results are the same, up to
+        rounding, that would be obtained by passing the paths to a
+        StepPathPricer.  Unlike
+        LazyPathSimulation, any random-number policy can be used, but
+        the whole sequence is drawn for each path.
+    */
+    template <class RNG, class StepPricer, class S = Statistics>
+    class FusedPathSimulation {
+      public:
+        typedef S stats_type;
+        FusedPathSimulation(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  const TimeGrid& grid,
+                  StepPricer pricer,
+                  bool brownianBridge,
+                  bool antitheticVariate,
+                  BigNatural seed);
+        void calculate(Real requiredTolerance,
+                       Size requiredSamples,
+                       Size maxSamples);
+        void addSamples(Size samples);
+        const stats_type& sampleAccumulator() const {
+            return sampleAccumulator_;
+        }
+        Size samples() const { return sampleAccumulator_.samples(); }
+        Real errorEstimate() const {
+            return sampleAccumulator_.errorEstimate();
+        }
+      private:
+        Real simulatePath(StepPricer& pricer, bool antithetic);
+        StepPricer pricer_;
+        bool brownianBridge_, antitheticVariate_;
+        typename RNG::rsg_type generator_;
+        BrownianBridge bridge_;
+        Real x0_, logX0_;
+        std::vector<Real> drift_, diffusion_, variates_, increments_;
+        stats_type sampleAccumulator_;
+    };
+
+
+    // template definitions
+
+    template <class RNG, class P, class S>
+    inline FusedPathSimulation<RNG,P,S>::FusedPathSimulation(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  const TimeGrid& grid,
+                  P pricer,
+                  bool brownianBridge,
+                  bool antitheticVariate,
+                  BigNatural seed)
+    : pricer_(std::move(pricer)), brownianBridge_(brownianBridge),
+      antitheticVariate_(antitheticVariate),
+      generator_(RNG::make_sequence_generator(grid.size()-1, seed)),
+      bridge_(grid), x0_(process->x0()), logX0_(std::log(x0_)),
+      drift_(grid.size()-1), diffusion_(grid.size()-1),
+      variates_(grid.size()-1), increments_(grid.size()-1) {
+        QL_REQUIRE(grid.size() > 1, "the time grid cannot be empty");
+        for (Size i=0; i<grid.size()-1; i++) {
+            // the same terms used by ConstantBlackScholesProcess::evolve
+            drift_[i] = process->drift(grid[i], x0_) * grid.dt(i);
+            diffusion_[i] = process->stdDeviation(grid[i], x0_, grid.dt(i));
+        }
+    }
+
+    template <class RNG, class P, class S>
+    inline void FusedPathSimulation<RNG,P,S>::calculate(
+                                                     Real requiredTolerance,
+                                                     Size requiredSamples,
+                                                     Size maxSamples) {
+        simulateToTarget(*this, requiredTolerance, requiredSamples,
+                         maxSamples);
+    }
+
+    template <class RNG, class P, class S>
+    inline void FusedPathSimulation<RNG,P,S>::addSamples(Size samples) {
+        P pricer = pricer_;
+        for (Size j=0; j<samples; j++) {
+            const std::vector<Real>& sequence =
+                generator_.nextSequence().value;
+            if (brownianBridge_)
+                bridge_.transform(sequence.begin(), sequence.end(),
+                                  variates_.begin());
+            else
+                std::copy(sequence.begin(), sequence.end(),
+                          variates_.begin());
+
+            Real price = simulatePath(pricer, false);
+            if (antitheticVariate_) {
+                Real price2 = simulatePath(pricer, true);
+                sampleAccumulator_.add((price+price2)/2.0, 1.0);
+            } else {
+                sampleAccumulator_.add(price, 1.0);
+            }
+        }
+    }
+
+    template <class RNG, class P, class S>
+    inline Real FusedPathSimulation<RNG,P,S>::simulatePath(
+                                                  P& pricer,
+                                                  bool antithetic) {
+        Size n = variates_.size();
+        Real sign = antithetic ? -1.0 : 1.0;
+        // the log-increments, in a loop that can be vectorized
+        for (Size i=0; i<n; i++)
+            increments_[i] = drift_[i] + diffusion_[i]*(sign*variates_[i]);
+
+        Real y = logX0_;
+        pricer.start(x0_);
+        Size i = 0;
+        for (; i<n; i++) {
+            y += increments_[i];
+            PathStatus::Type status = pricer.logStep(i, y);
+            if (status == PathStatus::Finished)
+                return pricer.value(std::exp(y));
+            if (status == PathStatus::TerminalOnly)
+                break;
+        }
+        // the pricer only needs the final value
+        for (++i; i<n; i++)
+            y += increments_[i];
+        return pricer.value(std::exp(y));
+    }
+
+}
+
+
+#endif
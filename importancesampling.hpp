@@ -0,0 +1,194 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file importancesampling.hpp
+    \brief Importance sampling by a shift of the Brownian drift
+*/
+
+#ifndef importance_sampling_hpp
+#define importance_sampling_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathgenerator.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/timegrid.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Path pricer applying the likelihood ratio of a drift shift
+    /*! Paths are assumed to be sampled from the given constant
+        Black-Scholes process after the Brownian motion \f$ W \f$ was
+        given a drift \f$ \theta \f$, i.e., from the same process with
+        its dividend yield decreased by \f$ \sigma \theta \f$ (see
+        shiftedProcess().)  The value returned by the underlying pricer
+        is multiplied by the Radon-Nikodym derivative
+        \f[
+            \frac{dP}{dQ} = \exp\left(-\theta W_T +
+                                      \frac{1}{2}\theta^2 T\right)
+        \f]
+        where \f$ W_T \f$ is recovered from the final value of the
+        path.  Since the weight only depends on the end of the path,
+        any pricer can be wrapped, including path-dependent ones.
+    */
+    class LikelihoodRatioPathPricer : public PathPricer<Path> {
+      public:
+        LikelihoodRatioPathPricer(
+                        ext::shared_ptr<PathPricer<Path> > pricer,
+                        const ext::shared_ptr<ConstantBlackScholesProcess>&,
+                        Real shift);
+        Real operator()(const Path& path) const override;
+      private:
+        ext::shared_ptr<PathPricer<Path> > pricer_;
+        Real drift_;
+        Volatility volatility_;
+        Real shift_;
+    };
+
+
+    //! results of the calibration of the drift shift
+    struct DriftShiftCalibration {
+        //! shift \f$ \theta \f$ of the Brownian drift
+        Real shift;
+        //! ratio of the plain and shifted variances, as estimated on the pilot run
+        Real varianceReduction;
+    };
+
+
+    //! process sampling the given one after a shift of the Brownian drift
+    inline ext::shared_ptr<ConstantBlackScholesProcess> shiftedProcess(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  Real shift) {
+        return ext::make_shared<ConstantBlackScholesProcess>(
+            process->x0(),
+            process->riskFreeRate(),
+            process->dividendYield() - process->volatility()*shift,
+            process->volatility());
+    }
+
+
+    //! calibrates the drift shift on a pilot run
+    /*! The pilot paths are sampled without shift; the returned shift
+        minimizes the pilot estimate of the second moment
+        \f[
+            M(\theta) = E_P\left[f^2 \exp\left(-\theta W_T +
+                                \frac{1}{2}\theta^2 T\right)\right]
+        \f]
+        of the weighted payoff \f$ f \f$ under the shifted measure.
+        \f$ M \f$ is convex, so its minimum is found by Newton's method.
+
+        The pilot must contain at least one non-null payoff.
+    */
+    template <class RNG>
+    DriftShiftCalibration calibrateDriftShift(
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  const TimeGrid& grid,
+                  const PathPricer<Path>& pricer,
+                  Size pilotSamples,
+                  BigNatural seed) {
+        QL_REQUIRE(pilotSamples > 1, "at least two pilot samples required");
+        Volatility sigma = process->volatility();
+        QL_REQUIRE(sigma > 0.0,
+                   "importance sampling requires a positive volatility");
+
+        typedef typename RNG::rsg_type generator_type;
+        generator_type rsg =
+            RNG::make_sequence_generator(grid.size()-1, seed);
+        PathGenerator<generator_type> generator(process, grid, rsg, false);
+
+        Time T = grid.back();
+        Real drift = process->drift(0.0, process->x0());
+
+        // Brownian values and squared payoffs of the pilot paths
+        std::vector<Real> w, f2;
+        w.reserve(pilotSamples);
+        f2.reserve(pilotSamples);
+        Real sum = 0.0, sum2 = 0.0;
+        for (Size j=0; j<pilotSamples; j++) {
+            const Path& path = generator.next().value;
+            Real f = pricer(path);
+            sum += f;
+            sum2 += f*f;
+            if (f != 0.0) {
+                w.push_back((std::log(path.back()/path.front()) - drift*T)
+                            / sigma);
+                f2.push_back(f*f);
+            }
+        }
+        QL_REQUIRE(!w.empty(),
+                   "no positive payoff in the " << pilotSamples
+                   << " pilot samples; increase their number");
+
+        // M(theta), rescaled to avoid overflows, and its derivatives
+        auto moments = [&](Real theta, Real& m, Real& dm, Real& d2m) {
+            Real maxExponent = -QL_MAX_REAL;
+            for (Real wj : w)
+                maxExponent = std::max(maxExponent,
+                                       -theta*wj + 0.5*theta*theta*T);
+            m = dm = d2m = 0.0;
+            for (Size j=0; j<w.size(); j++) {
+                Real g = theta*T - w[j];
+                Real e = f2[j] * std::exp(-theta*w[j] + 0.5*theta*theta*T
+                                          - maxExponent);
+                m += e;
+                dm += e*g;
+                d2m += e*(g*g + T);
+            }
+            return maxExponent;
+        };
+
+        Real theta = 0.0, m, dm, d2m;
+        for (Size k=0; k<100; k++) {
+            moments(theta, m, dm, d2m);
+            Real delta = dm/d2m;
+            theta -= delta;
+            if (std::fabs(delta) < 1.0e-10)
+                break;
+        }
+
+        Real scale = moments(theta, m, dm, d2m);
+        Real n = static_cast<Real>(pilotSamples);
+        Real mean = sum/n;
+        Real plainVariance = sum2/n - mean*mean;
+        Real shiftedVariance = m*std::exp(scale)/n - mean*mean;
+
+        DriftShiftCalibration result;
+        result.shift = theta;
+        result.varianceReduction =
+            shiftedVariance > 0.0 ? plainVariance/shiftedVariance
+                                  : Null<Real>();
+        return result;
+    }
+
+
+    // inline definitions
+
+    inline LikelihoodRatioPathPricer::LikelihoodRatioPathPricer(
+                  ext::shared_ptr<PathPricer<Path> > pricer,
+                  const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                  Real shift)
+    : pricer_(std::move(pricer)),
+      drift_(process->drift(0.0, process->x0())),
+      volatility_(process->volatility()), shift_(shift) {
+        QL_REQUIRE(pricer_, "null path pricer");
+        QL_REQUIRE(volatility_ > 0.0,
+                   "importance sampling requires a positive volatility");
+    }
+
+    inline Real LikelihoodRatioPathPricer::operator()(const Path& path) const {
+        Real value = (*pricer_)(path);
+        if (value == 0.0)
+            return 0.0;
+        Time T = path.timeGrid().back() - path.timeGrid().front();
+        Real w = (std::log(path.back()/path.front()) - drift_*T)
+                 / volatility_;
+        return value * std::exp(-shift_*w + 0.5*shift_*shift_*T);
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,297 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file lazypathsimulation.hpp
+    \brief Monte Carlo simulation feeding paths to the pricer step by step
+*/
+
+#ifndef lazy_path_simulation_hpp
+#define lazy_path_simulation_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include "samplecontrol.hpp"
+#include <ql/math/randomnumbers/rngtraits.hpp>
+#include <ql/math/statistics/statistics.hpp>
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/stochasticprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <cmath>
+#include <utility>
+
+namespace QuantLib {
+
+    //! state of a path being priced one step at a time
+    struct PathStatus {
+        enum Type { Alive,        //!< further steps are needed
+                    Finished,     //!< the payoff is known
+                    TerminalOnly  //!< only the final value is needed
+        };
+    };
+
+    /*! \defgroup steppricers Step pricers
+
+        A step pricer receives the values of the underlying as they
+        are simulated instead of a complete Path.  It must provide
+        the following methods:
+        - <tt>void start(Real x0)</tt>, called at the beginning of
+          each path with the initial value;
+        - <tt>PathStatus::Type step(Size i, Real x)</tt>, called with
+          the value at the end of the \f$ i \f$-th step of the grid;
+        - <tt>PathStatus::Type logStep(Size i, Real y)</tt>, the same
+          as step() but called with \f$ y = \ln x \f$ by simulations
+          evolving the logarithm of the underlying (see
+          FusedPathSimulation), so that the pricer can work in log
+          space, e.g., by comparing \f$ y \f$ with the logarithm of
+          a barrier, without exponentiating at each step;
+        - <tt>Real value(Real x) const</tt>, returning the discounted
+          payoff of the path given its last simulated value (which is
+          the value at maturity unless the pricer returned
+          PathStatus::Finished.)
+    */
+
+    //! Path pricer adapting a step pricer to complete paths
+    template <class StepPricer>
+    class StepPathPricer : public PathPricer<Path> {
+      public:
+        explicit StepPathPricer(StepPricer pricer)
+        : pricer_(std::move(pricer)) {}
+        Real operator()(const Path& path) const override {
+            Size n = path.length();
+            QL_REQUIRE(n>1, "the path cannot be empty");
+            pricer_.start(path.front());
+            for (Size i=0; i<n-1; i++) {
+                if (pricer_.step(i, path[i+1]) != PathStatus::Alive)
+                    break;
+            }
+            return pricer_.value(path.back());
+        }
+      private:
+        mutable StepPricer pricer_;
+    };
+
+
+    //! Monte Carlo simulation generating paths lazily
+    /*! Each step is drawn and evolved only when the pricer asks for
+        it.  When the pricer reports that the payoff is known (e.g., a
+        knock-out barrier was hit) the rest of the path is skipped;
+        when it reports that only the final value is needed (e.g., a
+        knock-in barrier was hit) the remaining steps are replaced by
+        a single step to maturity, which is exact for
+        Black-Scholes processes.
+
+        Normal variates are drawn from a PseudoRandom generator with
+        the given seed, in the same order used by PathGenerator with
+        the corresponding sequence generator; therefore, paths that
+        are not cut short are the same that a path generator without
+        Brownian bridge would return.  The antithetic path reuses the
+        variates drawn for the original one, including the one used
+        for the step to maturity, and draws new ones only if it goes
+        further.
+
+        If the process is a ConstantBlackScholesProcess, the drift and
+        diffusion terms of each step, and those of the steps to
+        maturity from each node, are computed once; the logarithm of
+        the underlying is then evolved by additions and passed to the
+        pricer through its logStep() method, as in
+        FusedPathSimulation.  Other processes are evolved through
+        their evolve() method.  Unlike FusedPathSimulation, the
+        increments are computed one at a time; therefore, skipping
+        steps only pays off when a large part of the paths is cut
+        short early.
+
+        The interface follows McSimulation; the number of samples is
+        controlled by simulateToTarget().
+    */
+    template <class StepPricer, class S = Statistics>
+    class LazyPathSimulation {
+      public:
+        typedef S stats_type;
+        LazyPathSimulation(ext::shared_ptr<StochasticProcess1D> process,
+                           TimeGrid grid,
+                           StepPricer pricer,
+                           bool antitheticVariate,
+                           BigNatural seed);
+        void calculate(Real requiredTolerance,
+                       Size requiredSamples,
+                       Size maxSamples);
+        void addSamples(Size samples);
+        const stats_type& sampleAccumulator() const {
+            return sampleAccumulator_;
+        }
+        Size samples() const { return sampleAccumulator_.samples(); }
+        Real errorEstimate() const {
+            return sampleAccumulator_.errorEstimate();
+        }
+        //! average number of steps actually simulated for each path
+        Real stepsPerPath() const;
+      private:
+        Real simulatePath(bool antithetic);
+        Real simulateLogPath(bool antithetic);
+        Real variate(Size i, bool antithetic);
+        Real terminalVariate(bool antithetic);
+        ext::shared_ptr<StochasticProcess1D> process_;
+        TimeGrid grid_;
+        StepPricer pricer_;
+        bool antitheticVariate_;
+        PseudoRandom::rng_type generator_;
+        Real x0_;
+        std::vector<Real> variates_;
+        Size drawn_;
+        Real terminalVariate_;
+        bool terminalDrawn_;
+        // log-space terms, only used with constant processes
+        bool logSpace_;
+        Real logX0_;
+        std::vector<Real> drift_, diffusion_;
+        std::vector<Real> remainingDrift_, remainingDiffusion_;
+        stats_type sampleAccumulator_;
+        Size paths_, steps_;
+    };
+
+
+    // template definitions
+
+    template <class P, class S>
+    inline LazyPathSimulation<P,S>::LazyPathSimulation(
+                             ext::shared_ptr<StochasticProcess1D> process,
+                             TimeGrid grid,
+                             P pricer,
+                             bool antitheticVariate,
+                             BigNatural seed)
+    : process_(std::move(process)), grid_(std::move(grid)),
+      pricer_(std::move(pricer)), antitheticVariate_(antitheticVariate),
+      generator_(PseudoRandom::urng_type(seed)), x0_(process_->x0()),
+      variates_(grid_.size()-1), drawn_(0), terminalVariate_(0.0),
+      terminalDrawn_(false), logSpace_(false), logX0_(0.0),
+      paths_(0), steps_(0) {
+        QL_REQUIRE(grid_.size() > 1, "the time grid cannot be empty");
+        ext::shared_ptr<ConstantBlackScholesProcess> constantProcess =
+            ext::dynamic_pointer_cast<ConstantBlackScholesProcess>(process_);
+        if (constantProcess) {
+            Size n = grid_.size()-1;
+            logSpace_ = true;
+            logX0_ = std::log(x0_);
+            drift_.resize(n);
+            diffusion_.resize(n);
+            for (Size i=0; i<n; i++) {
+                // the same terms used by ConstantBlackScholesProcess::evolve
+                drift_[i] = constantProcess->drift(grid_[i], x0_) * grid_.dt(i);
+                diffusion_[i] =
+                    constantProcess->stdDeviation(grid_[i], x0_, grid_.dt(i));
+            }
+            // the single step from each node to maturity
+            remainingDrift_.resize(n);
+            remainingDiffusion_.resize(n);
+            for (Size i=0; i<n; i++) {
+                Time dt = grid_.back() - grid_[i];
+                remainingDrift_[i] = constantProcess->drift(grid_[i], x0_) * dt;
+                remainingDiffusion_[i] =
+                    constantProcess->stdDeviation(grid_[i], x0_, dt);
+            }
+        }
+    }
+
+    template <class P, class S>
+    inline void LazyPathSimulation<P,S>::calculate(Real requiredTolerance,
+                                                   Size requiredSamples,
+                                                   Size maxSamples) {
+        simulateToTarget(*this, requiredTolerance, requiredSamples,
+                         maxSamples);
+    }
+
+    template <class P, class S>
+    inline void LazyPathSimulation<P,S>::addSamples(Size samples) {
+        for (Size j=0; j<samples; j++) {
+            drawn_ = 0;
+            terminalDrawn_ = false;
+            Real price = logSpace_ ? simulateLogPath(false)
+                                   : simulatePath(false);
+            if (antitheticVariate_) {
+                Real price2 = logSpace_ ? simulateLogPath(true)
+                                        : simulatePath(true);
+                sampleAccumulator_.add((price+price2)/2.0, 1.0);
+            } else {
+                sampleAccumulator_.add(price, 1.0);
+            }
+        }
+    }
+
+    template <class P, class S>
+    inline Real LazyPathSimulation<P,S>::stepsPerPath() const {
+        return paths_ == 0 ? 0.0 : Real(steps_)/Real(paths_);
+    }
+
+    template <class P, class S>
+    inline Real LazyPathSimulation<P,S>::variate(Size i, bool antithetic) {
+        if (i == drawn_)
+            variates_[drawn_++] = generator_.next().value;
+        return antithetic ? -variates_[i] : variates_[i];
+    }
+
+    template <class P, class S>
+    inline Real LazyPathSimulation<P,S>::terminalVariate(bool antithetic) {
+        // drawn by the first of the paired paths needing it, so that
+        // the antithetic path mirrors the step to maturity too
+        if (!terminalDrawn_) {
+            terminalVariate_ = generator_.next().value;
+            terminalDrawn_ = true;
+        }
+        return antithetic ? -terminalVariate_ : terminalVariate_;
+    }
+
+    template <class P, class S>
+    inline Real LazyPathSimulation<P,S>::simulatePath(bool antithetic) {
+        Size n = grid_.size()-1;
+        Real x = x0_;
+        ++paths_;
+        pricer_.start(x);
+        for (Size i=0; i<n; i++) {
+            x = process_->evolve(grid_[i], x, grid_.dt(i),
+                                 variate(i, antithetic));
+            ++steps_;
+            PathStatus::Type status = pricer_.step(i, x);
+            if (status == PathStatus::Finished)
+                break;
+            if (status == PathStatus::TerminalOnly) {
+                if (i < n-1) {
+                    // one step to maturity replaces the remaining ones
+                    x = process_->evolve(grid_[i+1], x,
+                                         grid_.back() - grid_[i+1],
+                                         terminalVariate(antithetic));
+                    ++steps_;
+                }
+                break;
+            }
+        }
+        return pricer_.value(x);
+    }
+
+    template <class P, class S>
+    inline Real LazyPathSimulation<P,S>::simulateLogPath(bool antithetic) {
+        Size n = grid_.size()-1;
+        Real y = logX0_;
+        ++paths_;
+        pricer_.start(x0_);
+        for (Size i=0; i<n; i++) {
+            y += drift_[i] + diffusion_[i]*variate(i, antithetic);
+            ++steps_;
+            PathStatus::Type status = pricer_.logStep(i, y);
+            if (status == PathStatus::Finished)
+                break;
+            if (status == PathStatus::TerminalOnly) {
+                if (i < n-1) {
+                    // one step to maturity replaces the remaining ones
+                    y += remainingDrift_[i+1] +
+                         remainingDiffusion_[i+1]*terminalVariate(antithetic);
+                    ++steps_;
+                }
+                break;
+            }
+        }
+        return pricer_.value(std::exp(y));
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,156 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file marketupdate.hpp
+    \brief Market-data updates with deferred notifications
+*/
+
+#ifndef market_update_hpp
+#define market_update_hpp
+
+#include "shardlauncher.hpp"
+#include <ql/instrument.hpp>
+#include <ql/patterns/observable.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace QuantLib {
+
+    //! market-data update applied as a single transaction
+    /*! While an instance is alive, notifications are deferred (see
+        ObservableSettings::disableUpdates()); quotes can be set and
+        curves relinked without any instrument being notified, and
+        thus possibly recalculated, with a partial snapshot.  When the
+        update is committed (or the instance is destroyed) each
+        observer that was notified in the meantime is notified once,
+        regardless of the number of changes.
+
+        The purpose of the transaction is consistency, not speed: the
+        engines in this project already forward a single notification
+        to their instruments between two calculations (see
+        NotificationGate), so the instruments are notified as many
+        times with or without it.
+
+        If notifications are already disabled when the update starts,
+        e.g., by an enclosing update, they are left disabled when it
+        ends.
+    */
+    class MarketUpdate {
+      public:
+        MarketUpdate();
+        ~MarketUpdate();
+        MarketUpdate(const MarketUpdate&) = delete;
+        MarketUpdate& operator=(const MarketUpdate&) = delete;
+        //! re-enables and sends the deferred notifications
+        void commit();
+      private:
+        bool active_;
+    };
+
+
+    //! forwards the first notification after each calculation
+    /*! An engine is usually registered with a process that is in
+        turn registered with several quotes and curves, so a market
+        update notifies it once for each change.  After the first
+        notification, all the instruments it prices are already
+        invalidated; the following ones can be dropped until the
+        engine performs a calculation.
+    */
+    class NotificationGate {
+      public:
+        NotificationGate() : closed_(false) {}
+        //! returns whether the notification should be forwarded
+        bool pass() {
+            if (closed_)
+                return false;
+            closed_ = true;
+            return true;
+        }
+        //! to be called when the engine performs a calculation
+        void reset() { closed_ = false; }
+      private:
+        bool closed_;
+    };
+
+
+    //! counts the notifications sent by the observed objects
+    class NotificationCounter : public Observer {
+      public:
+        NotificationCounter() : count_(0) {}
+        void update() override { ++count_; }
+        Size count() const { return count_; }
+        void reset() { count_ = 0; }
+      private:
+        Size count_;
+    };
+
+
+    //! values of the given instruments, calculated in worker processes
+    /*! The instruments are split in contiguous slices, one for each
+        worker (see runInWorkers()), and their values are returned in
+        the same order.  This is a value-only batch pricer: all the
+        given instruments are priced, whether or not they need a
+        recalculation, and the results are not stored in them; the
+        instruments in the calling process are left as they were, and
+        a following call to their NPV() method recalculates them if
+        they were invalidated.  It is meant for publishing the values
+        of a book after a market update.
+    */
+    inline std::vector<Real> valuesInWorkers(
+                 const std::vector<ext::shared_ptr<Instrument> >& instruments,
+                 Size workers) {
+        Size n = instruments.size();
+        QL_REQUIRE(workers > 0, "no workers given");
+        workers = std::min(workers, std::max<Size>(n, 1));
+        std::vector<std::string> slices = runInWorkers(
+            workers,
+            [&](Size i) {
+                Size begin = i*n/workers, end = (i+1)*n/workers;
+                std::string data((end-begin)*sizeof(Real), '\0');
+                for (Size j=begin; j<end; j++) {
+                    Real value = instruments[j]->NPV();
+                    std::memcpy(&data[(j-begin)*sizeof(Real)], &value,
+                                sizeof(Real));
+                }
+                return data;
+            });
+        std::vector<Real> values(n);
+        for (Size i=0; i<workers; i++) {
+            Size begin = i*n/workers, end = (i+1)*n/workers;
+            QL_REQUIRE(slices[i].size() == (end-begin)*sizeof(Real),
+                       "wrong number of values from worker " << i);
+            if (end > begin)
+                std::memcpy(&values[begin], slices[i].data(),
+                            slices[i].size());
+        }
+        return values;
+    }
+
+
+    // inline definitions
+
+    inline MarketUpdate::MarketUpdate()
+    : active_(ObservableSettings::instance().updatesEnabled()) {
+        if (active_)
+            ObservableSettings::instance().disableUpdates(true);
+    }
+
+    inline MarketUpdate::~MarketUpdate() {
+        try {
+            commit();
+        } catch (...) {
+            // destructors must not throw
+        }
+    }
+
+    inline void MarketUpdate::commit() {
+        if (active_) {
+            active_ = false;
+            ObservableSettings::instance().enableUpdates();
+        }
+    }
+
+}
+
+
+#endif
@@ -24,16 +24,109 @@
 #ifndef mc_discrete_arithmetic_average_strike_asian_engine_hpp
 #define mc_discrete_arithmetic_average_strike_asian_engine_hpp
 
+#include "batchsampling.hpp"
+#include "constantblackscholesprocess.hpp"
+#include "controlvariate.hpp"
+#include "curvesensitivities.hpp"
+#include "fixingdatesimulation.hpp"
+#include "marketupdate.hpp"
+#include "mccheckpoint.hpp"
+#include "mckernel.hpp"
+#include "mcprofile.hpp"
+#include "mcsetupcache.hpp"
+#include "shardedsimulation.hpp"
 #include <ql/exercise.hpp>
 #include <ql/pricingengines/asian/mcdiscreteasianenginebase.hpp>
 #include <ql/pricingengines/asian/mc_discr_arith_av_strike.hpp>
 #include <ql/processes/blackscholesprocess.hpp>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
 #include <utility>
 
 namespace QuantLib {
 
     //!  Monte Carlo pricing engine for discrete arithmetic average-strike Asian
-    /*!  \ingroup asianengines */
+    /*!  If constant parameters are required, paths are generated with
+         a ConstantBlackScholesProcess extracted from the given process
+         at the exercise date.  Since the strike is not known in advance,
+         the at-the-money volatility is used.  In this case, the
+         underlying is only simulated on the fixing dates with exact
+         steps by a FixingDateSimulation, which updates the running
+         average in place instead of building a path; unless other
+         options below are required, the simulation is delegated to
+         mcAverageStrikeAsianKernel().
+
+         Fitted parameters can be required instead: the constant
+         drift and volatility are then fitted to the forwards and
+         Black variances of the given process at the future fixing
+         times, while the risk-free rate is still taken at the
+         exercise date (see ConstantBlackScholesProcess.)  This
+         reduces the bias of constant mode when the rates or the
+         volatilities have a term structure within the fixing period.
+
+         The time grid, the constant process and the path generator are
+         kept across calculations and rebuilt only when their inputs
+         change (see McSetupCache.)
+
+         If a shard range is given, only the samples in the range are
+         simulated (see ShardRange) and the serialized state of the
+         shard is returned as the \c shardState additional result; the
+         states of the shards can be merged by mergeShards().  The
+         number of samples and the tolerance are not used in this case.
+
+         If profiling is enabled, the time spent in each phase of the
+         calculation and the number of paths and steps are returned
+         as \c profile.* additional results (see McProfile); the
+         times of the generation of the random numbers and of the
+         accumulation of the samples are estimates.  With constant
+         parameters, the payoff is evaluated during the evolution and
+         its time is included in the latter.
+
+         With constant parameters, a control variate can be required:
+         the paths are then simulated on the fixing dates by the
+         constant process, and an at-the-money plain vanilla on the
+         last fixing is priced on each of them, with its Black price as
+         the known expectation (see ControlVariateSimulation.)  The
+         optimal coefficient and the ratio between the plain and the
+         controlled variance are returned as the
+         \c controlVariateCoefficient and
+         \c controlVariateVarianceReduction additional results.  This
+         is not compatible with sharding.
+
+         Stratified or moment-matched sampling can be required instead
+         of plain sampling (see SamplingScheme); paths are then
+         simulated on the fixing dates in batches by a
+         BatchSampledSimulation, with the constant process if constant
+         parameters are required.  This is not compatible with control
+         variates or sharding, and requires pseudo-random numbers.
+
+         If a checkpoint is given, the simulation (on full paths or on
+         the fixing dates, depending on the parameters) is stored in
+         it and continued by later calculations with the same inputs,
+         possibly by a different engine requiring more samples or a
+         tighter tolerance (see McCheckpoint); the number of samples
+         taken from the checkpoint is returned as the
+         \c reusedSamples additional result.  This is not compatible
+         with control variates, batch sampling, sharding or profiling.
+
+         In non-constant mode, the sensitivities of the value to the
+         zero rates at the nodes of the risk-free curve, which must be
+         a ZeroCurve, and to the volatilities of the Black curve at the
+         given dates can be required; they are computed in the same
+         simulation as the value by an adjoint path pricer (see
+         ArithmeticASOAdjointPathPricer) and returned as the
+         \c zeroRateSensitivities and \c volatilitySensitivities
+         additional results.  This is not compatible with batch
+         sampling, sharding, checkpoints or profiling.
+
+         Notifications from the process are forwarded to the
+         instruments only once between two calculations, since after
+         the first one they are already invalidated (see
+         NotificationGate and MarketUpdate.)
+
+         \ingroup asianengines
+    */
     template <class RNG = PseudoRandom, class S = Statistics>
     class MCDiscreteArithmeticASEngine_2
         : public MCDiscreteAveragingAsianEngineBase<SingleVariate,RNG,S> {
@@ -53,11 +146,177 @@ namespace QuantLib {
              Size requiredSamples,
              Real requiredTolerance,
              Size maxSamples,
-             BigNatural seed);
+             BigNatural seed,
+             bool constantParameters,
+             const ShardRange& shard,
+             bool profiling,
+             bool controlVariate,
+             const SamplingScheme& sampling,
+             ext::shared_ptr<McCheckpoint> checkpoint,
+             bool curveSensitivities,
+             std::vector<Date> volatilityNodes,
+             bool fittedParameters);
+        void calculate() const override;
+        void update() override;
       protected:
+        TimeGrid timeGrid() const override;
+        ext::shared_ptr<path_generator_type> pathGenerator() const override;
+        ext::shared_ptr<path_generator_type> pathGenerator(BigNatural seed) const;
         ext::shared_ptr<path_pricer_type> pathPricer() const override;
+        ext::shared_ptr<ConstantBlackScholesProcess> constantProcess() const;
+        bool constantParameters_;
+      private:
+        template <class Stats>
+        FixingDateSimulation<RNG,Stats> fixingDateSimulation(
+                                                      BigNatural seed) const;
+        void calculateShard() const;
+        // returns the number of samples
+        Size calculateWithControlVariate() const;
+        // returns the number of paths
+        Size calculateWithSampling() const;
+        McCheckpointKey checkpointKey() const;
+        void calculateFromCheckpoint() const;
+        void calculateCurveSensitivities() const;
+        // returns the number of samples
+        Size calculateWithKernel() const;
+        ShardRange shard_;
+        mutable McSetupCache<RNG> setup_;
+        mutable McProfile profile_;
+        bool controlVariate_;
+        SamplingScheme sampling_;
+        ext::shared_ptr<McCheckpoint> checkpoint_;
+        bool curveSensitivities_;
+        std::vector<Date> volatilityNodes_;
+        bool fittedParameters_;
+        mutable NotificationGate gate_;
+    };
+
+
+    //! adjoint path pricer for discrete arithmetic average-strike Asians
+    /*! The payoff is the same as that of ArithmeticASOPathPricer; the
+        first node of the path is the current value of the underlying,
+        which is a fixing only if one falls on the evaluation date,
+        i.e., if the first mandatory time of the grid is null.  It
+        doesn't depend on the curves, so its gradient doesn't
+        contribute to the sensitivities.
+    */
+    class ArithmeticASOAdjointPathPricer : public CurveAdjointPathPricer {
+      public:
+        ArithmeticASOAdjointPathPricer(
+                 const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                 const TimeGrid& grid,
+                 Time exerciseTime,
+                 Option::Type type,
+                 Real runningSum = 0.0,
+                 Size pastFixings = 0);
+      protected:
+        Real payoff(const Path& path,
+                    std::vector<Real>& gradient) const override;
+      private:
+        Option::Type type_;
+        Real runningSum_;
+        Size pastFixings_;
+    };
+
+
+    //! average-strike Asian option priced by mcAverageStrikeAsianKernel()
+    /*! \ingroup mckernels */
+    struct AverageStrikeAsianKernelParameters {
+        Option::Type type = Option::Call;
+        //! times of the fixings not in the past
+        std::vector<Time> fixingTimes;
+        //! payment time
+        Time maturity = Null<Time>();
+        //! sum of the past fixings
+        Real runningSum = 0.0;
+        Size pastFixings = 0;
     };
 
+    //! stateless Monte Carlo pricing of an average-strike Asian option
+    /*! The underlying is simulated on the fixing times by a
+        FixingDateSimulation; the results are those of
+        MCDiscreteArithmeticASEngine_2 with constant parameters.  The
+        number of steps in the settings is not used.  See
+        \ref mckernels.
+
+        \ingroup mckernels
+    */
+    template <class RNG = PseudoRandom, class S = Statistics>
+    McKernelResult mcAverageStrikeAsianKernel(
+                              const BlackScholesParameters& market,
+                              const AverageStrikeAsianKernelParameters& option,
+                              const McKernelSettings& settings);
+
+
+    //! Monte Carlo pricing of a batch of discrete arithmetic average-strike Asians
+    /*! The options, possibly seasoned (i.e., with past fixings and a
+        running accumulator) and with different fixing dates, are
+        grouped by exercise date; the options in each group are
+        priced with one FixingDateSimulation on the union of their
+        future fixing times.  They must be written on the underlying
+        described by the given process; as in
+        MCDiscreteArithmeticASEngine_2, the constant parameters of
+        each group are extracted at its exercise date, using the
+        at-the-money volatility.
+
+        The option arguments are read by calculate().
+    */
+    template <class RNG = PseudoRandom, class S = Statistics>
+    class MCDiscreteArithmeticASBatch_2 {
+      public:
+        MCDiscreteArithmeticASBatch_2(
+             ext::shared_ptr<GeneralizedBlackScholesProcess> process,
+             bool brownianBridge,
+             bool antitheticVariate,
+             Size requiredSamples,
+             Real requiredTolerance,
+             Size maxSamples,
+             BigNatural seed);
+        //! adds an option to the batch and returns its index
+        Size add(const ext::shared_ptr<DiscreteAveragingAsianOption>& option);
+        void calculate();
+        //! \name Results
+        //@{
+        Size size() const { return options_.size(); }
+        Real NPV(Size i) const;
+        Real errorEstimate(Size i) const;
+        //@}
+      private:
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        bool brownianBridge_, antitheticVariate_;
+        Size requiredSamples_, maxSamples_;
+        Real requiredTolerance_;
+        BigNatural seed_;
+        std::vector<ext::shared_ptr<DiscreteAveragingAsianOption> > options_;
+        std::vector<Real> values_, errors_;
+    };
+
+
+    namespace detail {
+
+        // times of the fixings not in the past, as in the engine base class
+        inline std::vector<Time> futureFixingTimes(
+                              const GeneralizedBlackScholesProcess& process,
+                              const std::vector<Date>& fixingDates) {
+            std::vector<Time> times;
+            for (const Date& d : fixingDates) {
+                Time t = process.time(d);
+                if (t >= 0)
+                    times.push_back(t);
+            }
+            return times;
+        }
+
+        inline std::vector<Size> fixingNodes(const TimeGrid& grid,
+                                             const std::vector<Time>& times) {
+            std::vector<Size> nodes(times.size());
+            for (Size i=0; i<times.size(); i++)
+                nodes[i] = grid.index(times[i]);
+            return nodes;
+        }
+
+    }
+
 
     // inline definitions
 
@@ -70,7 +329,16 @@ namespace QuantLib {
              Size requiredSamples,
              Real requiredTolerance,
              Size maxSamples,
-             BigNatural seed)
+             BigNatural seed,
+             bool constantParameters,
+             const ShardRange& shard,
+             bool profiling,
+             bool controlVariate,
+             const SamplingScheme& sampling,
+             ext::shared_ptr<McCheckpoint> checkpoint,
+             bool curveSensitivities,
+             std::vector<Date> volatilityNodes,
+             bool fittedParameters)
     : MCDiscreteAveragingAsianEngineBase<SingleVariate,RNG,S>(process,
                                                               brownianBridge,
                                                               antitheticVariate,
@@ -78,7 +346,466 @@ namespace QuantLib {
                                                               requiredSamples,
                                                               requiredTolerance,
                                                               maxSamples,
-                                                              seed) {}
+                                                              seed),
+      constantParameters_(constantParameters), shard_(shard),
+      setup_(process), profile_(profiling), controlVariate_(controlVariate),
+      sampling_(sampling), checkpoint_(std::move(checkpoint)),
+      curveSensitivities_(curveSensitivities),
+      volatilityNodes_(std::move(volatilityNodes)),
+      fittedParameters_(fittedParameters) {
+        QL_REQUIRE(!shard.active() || RNG::allowsErrorEstimate,
+                   "sharding requires pseudo-random numbers");
+        QL_REQUIRE(!fittedParameters || constantParameters,
+                   "fitted parameters require constant parameters");
+        if (controlVariate) {
+            QL_REQUIRE(constantParameters,
+                       "control variate requires constant parameters");
+            QL_REQUIRE(!shard.active(),
+                       "control variate not compatible with sharding");
+        }
+        if (sampling.active()) {
+            QL_REQUIRE(RNG::allowsErrorEstimate,
+                       "stratified or moment-matched sampling requires "
+                       "pseudo-random numbers");
+            QL_REQUIRE(!controlVariate && !shard.active(),
+                       "stratified or moment-matched sampling not compatible "
+                       "with control variates or sharding");
+        }
+        if (checkpoint_) {
+            QL_REQUIRE(!controlVariate && !sampling.active() &&
+                       !shard.active() && !profiling,
+                       "checkpoint not compatible with control variates, "
+                       "batch sampling, sharding or profiling");
+        }
+        if (curveSensitivities) {
+            QL_REQUIRE(!constantParameters,
+                       "curve sensitivities not available "
+                       "with constant parameters");
+            QL_REQUIRE(!sampling.active() && !shard.active() &&
+                       !checkpoint_ && !profiling,
+                       "curve sensitivities not compatible with batch "
+                       "sampling, sharding, checkpoints or profiling");
+        }
+    }
+
+    template <class RNG, class S>
+    inline void MCDiscreteArithmeticASEngine_2<RNG,S>::update() {
+        if (gate_.pass())
+            this->notifyObservers();
+    }
+
+    template <class RNG, class S>
+    inline void MCDiscreteArithmeticASEngine_2<RNG,S>::calculate() const {
+
+        gate_.reset();
+        profile_.reset();
+
+        if (shard_.active()) {
+            {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                calculateShard();
+            }
+            if (profile_.enabled()) {
+                Size steps = this->timeGrid().size() - 1;
+                estimateSimulationPhases<RNG,AccumulatorState>(
+                    profile_, shard_.end - shard_.begin, steps, steps,
+                    this->antitheticVariate_, this->seed_);
+                profile_.store(this->results_);
+            }
+            return;
+        }
+
+        if (sampling_.active()) {
+            Size paths;
+            {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                paths = calculateWithSampling();
+            }
+            if (profile_.enabled()) {
+                Size steps = this->timeGrid().size() - 1;
+                estimateSimulationPhases<RNG,S>(
+                    profile_, paths, steps, steps,
+                    this->antitheticVariate_, this->seed_);
+                profile_.store(this->results_);
+            }
+            return;
+        }
+
+        if (checkpoint_) {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            calculateFromCheckpoint();
+            return;
+        }
+
+        if (curveSensitivities_) {
+            calculateCurveSensitivities();
+            return;
+        }
+
+        if (!constantParameters_) {
+            {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                MCDiscreteAveragingAsianEngineBase<SingleVariate,RNG,S>::
+                    calculate();
+            }
+            if (profile_.enabled()) {
+                Size steps = this->timeGrid().size() - 1;
+                estimateSimulationPhases<RNG,S>(
+                    profile_, this->mcModel_->sampleAccumulator().samples(),
+                    steps, steps, this->antitheticVariate_, this->seed_);
+                profile_.store(this->results_);
+            }
+            return;
+        }
+
+        if (controlVariate_) {
+            Size samples;
+            {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                samples = calculateWithControlVariate();
+            }
+            if (profile_.enabled()) {
+                Size steps = this->timeGrid().size() - 1;
+                estimateSimulationPhases<RNG,ControlVariateAccumulator>(
+                    profile_, samples, steps, steps,
+                    this->antitheticVariate_, this->seed_);
+                profile_.store(this->results_);
+            }
+            return;
+        }
+
+        Size samples;
+        {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            samples = calculateWithKernel();
+        }
+
+        if (profile_.enabled()) {
+            Size steps = this->timeGrid().size() - 1;
+            estimateSimulationPhases<RNG,S>(profile_, samples, steps, steps,
+                                            this->antitheticVariate_,
+                                            this->seed_);
+            profile_.store(this->results_);
+        }
+    }
+
+    template <class RNG, class S>
+    template <class Stats>
+    inline FixingDateSimulation<RNG,Stats>
+    MCDiscreteArithmeticASEngine_2<RNG,S>::fixingDateSimulation(
+                                                      BigNatural seed) const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        ext::shared_ptr<EuropeanExercise> exercise =
+            ext::dynamic_pointer_cast<EuropeanExercise>(
+                this->arguments_.exercise);
+        QL_REQUIRE(exercise, "wrong exercise given");
+
+        // the grid contains the fixing times only
+        TimeGrid grid = this->timeGrid();
+        ext::shared_ptr<ConstantBlackScholesProcess> process =
+            constantProcess();
+        FixingDateSimulation<RNG,Stats> simulation(
+            process, grid, this->brownianBridge_, this->antitheticVariate_,
+            seed);
+        // discounted as in mcAverageStrikeAsianKernel
+        simulation.add(payoff->optionType(),
+                       process->discount(
+                           this->process_->time(exercise->lastDate())),
+                       this->arguments_.runningAccumulator,
+                       this->arguments_.pastFixings,
+                       detail::fixingNodes(
+                           grid,
+                           detail::futureFixingTimes(
+                               *this->process_, this->arguments_.fixingDates)));
+        return simulation;
+    }
+
+    template <class RNG, class S>
+    inline Size
+    MCDiscreteArithmeticASEngine_2<RNG,S>::calculateWithKernel() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        ext::shared_ptr<EuropeanExercise> exercise =
+            ext::dynamic_pointer_cast<EuropeanExercise>(
+                this->arguments_.exercise);
+        QL_REQUIRE(exercise, "wrong exercise given");
+
+        AverageStrikeAsianKernelParameters option;
+        option.type = payoff->optionType();
+        option.fixingTimes = detail::futureFixingTimes(
+                                *this->process_, this->arguments_.fixingDates);
+        option.maturity = this->process_->time(exercise->lastDate());
+        option.runningSum = this->arguments_.runningAccumulator;
+        option.pastFixings = this->arguments_.pastFixings;
+
+        McKernelSettings settings;
+        settings.requiredSamples = this->requiredSamples_;
+        settings.requiredTolerance = this->requiredTolerance_;
+        settings.maxSamples = this->maxSamples_;
+        settings.seed = this->seed_;
+        settings.antitheticVariate = this->antitheticVariate_;
+        settings.brownianBridge = this->brownianBridge_;
+
+        McKernelResult result = mcAverageStrikeAsianKernel<RNG,S>(
+            blackScholesParameters(*constantProcess()), option, settings);
+        this->results_.value = result.value;
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate = result.errorEstimate;
+        return result.samples;
+    }
+
+    template <class RNG, class S>
+    inline McCheckpointKey
+    MCDiscreteArithmeticASEngine_2<RNG,S>::checkpointKey() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        McCheckpointKey key("MCDiscreteArithmeticASEngine_2");
+        key.add<const void*>(this->process_.get());
+        key.add<BigNatural>(this->seed_);
+        key.add<bool>(this->brownianBridge_);
+        key.add<bool>(this->antitheticVariate_);
+        key.add<bool>(constantParameters_);
+        key.add<bool>(fittedParameters_);
+        key.add(this->timeGrid());
+        key.add<Time>(
+            this->process_->time(this->arguments_.exercise->lastDate()));
+        key.add<int>(payoff->optionType());
+        key.add<Real>(payoff->strike());
+        key.add<Real>(this->arguments_.runningAccumulator);
+        key.add<Size>(this->arguments_.pastFixings);
+        return key;
+    }
+
+    template <class RNG, class S>
+    inline void
+    MCDiscreteArithmeticASEngine_2<RNG,S>::calculateFromCheckpoint() const {
+        Size reusedSamples;
+        if (constantParameters_) {
+            typedef FixingDateSimulation<RNG,S> simulation_type;
+            const simulation_type& simulation =
+                extendSimulation<simulation_type>(
+                    *checkpoint_, checkpointKey(), this->process_,
+                    [this]() { return fixingDateSimulation<S>(this->seed_); },
+                    this->requiredTolerance_, this->requiredSamples_,
+                    this->maxSamples_, reusedSamples);
+            this->results_.value = simulation.sampleAccumulator(0).mean();
+            if (RNG::allowsErrorEstimate)
+                this->results_.errorEstimate =
+                    simulation.sampleAccumulator(0).errorEstimate();
+        } else {
+            typedef ModelSimulation<RNG,S> simulation_type;
+            const simulation_type& simulation =
+                extendSimulation<simulation_type>(
+                    *checkpoint_, checkpointKey(), this->process_,
+                    [this]() {
+                        // a new generator, since the one in the set-up
+                        // cache is reset by later calculations
+                        TimeGrid grid = this->timeGrid();
+                        typename RNG::rsg_type rsg =
+                            RNG::make_sequence_generator(grid.size()-1,
+                                                         this->seed_);
+                        return simulation_type(
+                            ext::make_shared<
+                                typename simulation_type::model_type>(
+                                    ext::make_shared<path_generator_type>(
+                                        this->process_, grid, rsg,
+                                        this->brownianBridge_),
+                                    this->pathPricer(), S(),
+                                    this->antitheticVariate_));
+                    },
+                    this->requiredTolerance_, this->requiredSamples_,
+                    this->maxSamples_, reusedSamples);
+            this->mcModel_ = simulation.model();
+            this->results_.value = this->mcModel_->sampleAccumulator().mean();
+            if (RNG::allowsErrorEstimate)
+                this->results_.errorEstimate =
+                    this->mcModel_->sampleAccumulator().errorEstimate();
+        }
+        this->results_.additionalResults["reusedSamples"] = reusedSamples;
+    }
+
+    template <class RNG, class S>
+    inline void
+    MCDiscreteArithmeticASEngine_2<RNG,S>::calculateCurveSensitivities() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        ext::shared_ptr<EuropeanExercise> exercise =
+            ext::dynamic_pointer_cast<EuropeanExercise>(
+                this->arguments_.exercise);
+        QL_REQUIRE(exercise, "wrong exercise given");
+
+        auto pricer = ext::make_shared<ArithmeticASOAdjointPathPricer>(
+            this->process_, this->timeGrid(),
+            this->process_->time(exercise->lastDate()),
+            payoff->optionType(), this->arguments_.runningAccumulator,
+            this->arguments_.pastFixings);
+        this->mcModel_ =
+            ext::make_shared<MonteCarloModel<SingleVariate,RNG,S> >(
+                pathGenerator(), pricer, S(), this->antitheticVariate_);
+        ModelSimulation<RNG,S> simulation(this->mcModel_);
+        simulateToTarget(simulation, this->requiredTolerance_,
+                         this->requiredSamples_, this->maxSamples_);
+
+        this->results_.value = this->mcModel_->sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate =
+                this->mcModel_->sampleAccumulator().errorEstimate();
+        storeCurveSensitivities(*pricer, *this->process_, volatilityNodes_,
+                                this->results_);
+    }
+
+    template <class RNG, class S>
+    inline void MCDiscreteArithmeticASEngine_2<RNG,S>::calculateShard() const {
+        ShardState state = simulateShard(
+            this->seed_, shard_,
+            [this](BigNatural seed, Size samples) -> AccumulatorState {
+                if (constantParameters_) {
+                    FixingDateSimulation<RNG,AccumulatorState> simulation =
+                        fixingDateSimulation<AccumulatorState>(seed);
+                    simulation.addSamples(samples);
+                    return simulation.sampleAccumulator(0);
+                }
+                return simulatePaths<RNG>(pathGenerator(seed),
+                                          this->pathPricer(),
+                                          this->antitheticVariate_,
+                                          samples);
+            });
+        storeShardResults(state, this->results_);
+    }
+
+    template <class RNG, class S>
+    inline Size
+    MCDiscreteArithmeticASEngine_2<RNG,S>::calculateWithControlVariate() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        ext::shared_ptr<EuropeanExercise> exercise =
+            ext::dynamic_pointer_cast<EuropeanExercise>(
+                this->arguments_.exercise);
+        QL_REQUIRE(exercise, "wrong exercise given");
+
+        ext::shared_ptr<path_generator_type> generator;
+        ext::shared_ptr<path_pricer_type> controlPricer;
+        Real controlValue;
+        {
+            McProfile::Scope scope(profile_, McProfile::Setup);
+            // the grid contains the fixing times only
+            TimeGrid grid = this->timeGrid();
+            ext::shared_ptr<ConstantBlackScholesProcess> process =
+                constantProcess();
+            generator = setup_.pathGenerator(process, grid, this->seed_,
+                                             this->brownianBridge_);
+            // the control is paid at the same date as the option
+            std::tie(controlPricer, controlValue) =
+                terminalVanillaControl(
+                    process, payoff->optionType(), process->x0(),
+                    grid.back(),
+                    this->process_->riskFreeRate()->discount(
+                                                      exercise->lastDate()));
+            if (profile_.enabled())
+                controlPricer =
+                    ext::make_shared<ProfiledPathPricer>(controlPricer,
+                                                         profile_);
+        }
+
+        ControlVariateSimulation<RNG> simulation(generator,
+                                                 this->pathPricer(),
+                                                 controlPricer,
+                                                 controlValue,
+                                                 this->antitheticVariate_);
+        simulation.calculate(this->requiredTolerance_,
+                             this->requiredSamples_,
+                             this->maxSamples_);
+        this->results_.value = simulation.value();
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate = simulation.errorEstimate();
+        this->results_.additionalResults["controlVariateCoefficient"] =
+            simulation.accumulator().coefficient();
+        this->results_.additionalResults["controlVariateVarianceReduction"] =
+            simulation.accumulator().varianceReduction();
+        return simulation.samples();
+    }
+
+    template <class RNG, class S>
+    inline Size
+    MCDiscreteArithmeticASEngine_2<RNG,S>::calculateWithSampling() const {
+        ext::shared_ptr<StochasticProcess1D> process = this->process_;
+        if (constantParameters_)
+            process = constantProcess();
+
+        BatchSampledSimulation<RNG,S> simulation(process,
+                                                 this->timeGrid(),
+                                                 this->pathPricer(),
+                                                 this->brownianBridge_,
+                                                 this->antitheticVariate_,
+                                                 sampling_,
+                                                 this->seed_);
+        simulation.calculate(this->requiredTolerance_,
+                             this->requiredSamples_,
+                             this->maxSamples_);
+        this->results_.value = simulation.sampleAccumulator().mean();
+        this->results_.errorEstimate =
+            simulation.sampleAccumulator().errorEstimate();
+        return simulation.samples();
+    }
+
+    template <class RNG, class S>
+    inline TimeGrid MCDiscreteArithmeticASEngine_2<RNG,S>::timeGrid() const {
+        return setup_.timeGrid(detail::futureFixingTimes(
+                               *this->process_, this->arguments_.fixingDates));
+    }
+
+    template <class RNG, class S>
+    inline
+    ext::shared_ptr<
+          typename MCDiscreteArithmeticASEngine_2<RNG,S>::path_generator_type>
+    MCDiscreteArithmeticASEngine_2<RNG,S>::pathGenerator() const {
+        return pathGenerator(this->seed_);
+    }
+
+    template <class RNG, class S>
+    inline
+    ext::shared_ptr<
+          typename MCDiscreteArithmeticASEngine_2<RNG,S>::path_generator_type>
+    MCDiscreteArithmeticASEngine_2<RNG,S>::pathGenerator(BigNatural seed) const {
+        McProfile::Scope scope(profile_, McProfile::Setup);
+        return setup_.pathGenerator(this->process_, this->timeGrid(),
+                                    seed, this->brownianBridge_);
+    }
+
+    template <class RNG, class S>
+    inline ext::shared_ptr<ConstantBlackScholesProcess>
+    MCDiscreteArithmeticASEngine_2<RNG,S>::constantProcess() const {
+        ext::shared_ptr<EuropeanExercise> exercise =
+            ext::dynamic_pointer_cast<EuropeanExercise>(
+                this->arguments_.exercise);
+        QL_REQUIRE(exercise, "wrong exercise given");
+
+        // the at-the-money volatility, since the strike is not known
+        if (fittedParameters_)
+            return setup_.constantProcess(
+                exercise->lastDate(), this->process_->x0(),
+                detail::futureFixingTimes(*this->process_,
+                                          this->arguments_.fixingDates));
+        else
+            return setup_.constantProcess(exercise->lastDate(),
+                                          this->process_->x0());
+    }
 
     template <class RNG, class S>
     inline
@@ -86,6 +813,8 @@ namespace QuantLib {
                typename MCDiscreteArithmeticASEngine_2<RNG,S>::path_pricer_type>
     MCDiscreteArithmeticASEngine_2<RNG,S>::pathPricer() const {
 
+        McProfile::Scope scope(profile_, McProfile::Setup);
+
         ext::shared_ptr<PlainVanillaPayoff> payoff =
             ext::dynamic_pointer_cast<PlainVanillaPayoff>(
                 this->arguments_.payoff);
@@ -101,13 +830,180 @@ namespace QuantLib {
                 this->process_);
         QL_REQUIRE(process, "Black-Scholes process required");
 
-        return ext::shared_ptr<typename
-            MCDiscreteArithmeticASEngine_2<RNG,S>::path_pricer_type>(
+        ext::shared_ptr<path_pricer_type> pricer(
                 new ArithmeticASOPathPricer(
                     payoff->optionType(),
                     process->riskFreeRate()->discount(exercise->lastDate()),
                     this->arguments_.runningAccumulator,
                     this->arguments_.pastFixings));
+        if (profile_.enabled())
+            pricer = ext::make_shared<ProfiledPathPricer>(pricer, profile_);
+        return pricer;
+    }
+
+
+
+    template <class RNG, class S>
+    inline McKernelResult mcAverageStrikeAsianKernel(
+                             const BlackScholesParameters& market,
+                             const AverageStrikeAsianKernelParameters& option,
+                             const McKernelSettings& settings) {
+        QL_REQUIRE(!option.fixingTimes.empty(), "no future fixings given");
+        QL_REQUIRE(std::is_sorted(option.fixingTimes.begin(),
+                                  option.fixingTimes.end()),
+                   "fixing times must be sorted");
+        QL_REQUIRE(option.fixingTimes.front() >= 0.0,
+                   "negative fixing time given");
+        QL_REQUIRE(option.maturity != Null<Time>() && option.maturity >= 0.0,
+                   "non-negative maturity required");
+        ext::shared_ptr<ConstantBlackScholesProcess> process =
+            detail::kernelProcess(market);
+        // the grid contains the fixing times only
+        TimeGrid grid(option.fixingTimes.begin(), option.fixingTimes.end());
+        FixingDateSimulation<RNG,S> simulation(process, grid,
+                                               settings.brownianBridge,
+                                               settings.antitheticVariate,
+                                               settings.seed);
+        simulation.add(option.type, process->discount(option.maturity),
+                       option.runningSum, option.pastFixings,
+                       detail::fixingNodes(grid, option.fixingTimes));
+        simulation.calculate(settings.requiredTolerance,
+                             settings.requiredSamples, settings.maxSamples);
+        return detail::kernelResult<RNG>(simulation.sampleAccumulator(0));
+    }
+
+
+    inline ArithmeticASOAdjointPathPricer::ArithmeticASOAdjointPathPricer(
+                 const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                 const TimeGrid& grid,
+                 Time exerciseTime,
+                 Option::Type type,
+                 Real runningSum,
+                 Size pastFixings)
+    : CurveAdjointPathPricer(process, grid, exerciseTime), type_(type),
+      runningSum_(runningSum), pastFixings_(pastFixings) {}
+
+    inline Real ArithmeticASOAdjointPathPricer::payoff(
+                                         const Path& path,
+                                         std::vector<Real>& gradient) const {
+        Size n = path.length();
+        QL_REQUIRE(n>1, "the path cannot be empty");
+        // as in ArithmeticASOPathPricer, the initial value is a fixing
+        // if one falls on the evaluation date
+        Size first = path.timeGrid().mandatoryTimes()[0] == 0.0 ? 0 : 1;
+        Real fixings = pastFixings_ + n - first;
+        Real averageStrike =
+            (runningSum_ + std::accumulate(path.begin()+first, path.end(),
+                                           Real(0.0))) / fixings;
+        Real omega = type_ == Option::Call ? 1.0 : -1.0;
+        Real value = omega * (path.back() - averageStrike);
+        if (value <= 0.0)
+            return 0.0;
+        for (Size i=first; i<n; i++)
+            gradient[i] = -omega / fixings;
+        gradient[n-1] += omega;
+        return value;
+    }
+
+
+    template <class RNG, class S>
+    inline MCDiscreteArithmeticASBatch_2<RNG,S>::MCDiscreteArithmeticASBatch_2(
+             ext::shared_ptr<GeneralizedBlackScholesProcess> process,
+             bool brownianBridge,
+             bool antitheticVariate,
+             Size requiredSamples,
+             Real requiredTolerance,
+             Size maxSamples,
+             BigNatural seed)
+    : process_(std::move(process)), brownianBridge_(brownianBridge),
+      antitheticVariate_(antitheticVariate), requiredSamples_(requiredSamples),
+      maxSamples_(maxSamples), requiredTolerance_(requiredTolerance),
+      seed_(seed) {}
+
+    template <class RNG, class S>
+    inline Size MCDiscreteArithmeticASBatch_2<RNG,S>::add(
+                 const ext::shared_ptr<DiscreteAveragingAsianOption>& option) {
+        QL_REQUIRE(option, "null option given");
+        options_.push_back(option);
+        return options_.size()-1;
+    }
+
+    template <class RNG, class S>
+    inline void MCDiscreteArithmeticASBatch_2<RNG,S>::calculate() {
+        QL_REQUIRE(!options_.empty(), "no options given");
+
+        Size n = options_.size();
+        std::vector<DiscreteAveragingAsianOption::arguments> arguments(n);
+        std::vector<std::vector<Time> > fixingTimes(n);
+        std::vector<Date> exerciseDates;
+        for (Size i=0; i<n; i++) {
+            options_[i]->setupArguments(&arguments[i]);
+            arguments[i].validate();
+            QL_REQUIRE(arguments[i].averageType == Average::Arithmetic,
+                       "not an arithmetic average option");
+            fixingTimes[i] = detail::futureFixingTimes(
+                                      *process_, arguments[i].fixingDates);
+            QL_REQUIRE(!fixingTimes[i].empty(),
+                       "option #" << i << " has no future fixings");
+            Date exerciseDate = arguments[i].exercise->lastDate();
+            if (std::find(exerciseDates.begin(), exerciseDates.end(),
+                          exerciseDate) == exerciseDates.end())
+                exerciseDates.push_back(exerciseDate);
+        }
+
+        values_.resize(n);
+        errors_.resize(n);
+        for (const Date& exerciseDate : exerciseDates) {
+            std::vector<Size> group;
+            std::vector<Time> allTimes;
+            for (Size i=0; i<n; i++) {
+                if (arguments[i].exercise->lastDate() == exerciseDate) {
+                    group.push_back(i);
+                    allTimes.insert(allTimes.end(), fixingTimes[i].begin(),
+                                    fixingTimes[i].end());
+                }
+            }
+
+            // the union of the fixing times of the group
+            TimeGrid grid(allTimes.begin(), allTimes.end());
+            FixingDateSimulation<RNG,S> simulation(
+                ext::make_shared<ConstantBlackScholesProcess>(
+                    process_, exerciseDate, process_->x0()),
+                grid, brownianBridge_, antitheticVariate_, seed_);
+            for (Size i : group) {
+                ext::shared_ptr<PlainVanillaPayoff> payoff =
+                    ext::dynamic_pointer_cast<PlainVanillaPayoff>(
+                        arguments[i].payoff);
+                QL_REQUIRE(payoff, "non-plain payoff given");
+                simulation.add(payoff->optionType(),
+                               process_->riskFreeRate()->discount(exerciseDate),
+                               arguments[i].runningAccumulator,
+                               arguments[i].pastFixings,
+                               detail::fixingNodes(grid, fixingTimes[i]));
+            }
+            simulation.calculate(requiredTolerance_, requiredSamples_,
+                                 maxSamples_);
+
+            for (Size k=0; k<group.size(); k++) {
+                values_[group[k]] = simulation.sampleAccumulator(k).mean();
+                errors_[group[k]] = RNG::allowsErrorEstimate ?
+                    simulation.sampleAccumulator(k).errorEstimate() :
+                    Null<Real>();
+            }
+        }
+    }
+
+    template <class RNG, class S>
+    inline Real MCDiscreteArithmeticASBatch_2<RNG,S>::NPV(Size i) const {
+        QL_REQUIRE(i < values_.size(), "option #" << i << " not priced");
+        return values_[i];
+    }
+
+    template <class RNG, class S>
+    inline Real
+    MCDiscreteArithmeticASBatch_2<RNG,S>::errorEstimate(Size i) const {
+        QL_REQUIRE(i < errors_.size(), "option #" << i << " not priced");
+        return errors_[i];
     }
 
 
@@ -125,6 +1021,21 @@ namespace QuantLib {
         MakeMCDiscreteArithmeticASEngine_2& withSeed(BigNatural seed);
         MakeMCDiscreteArithmeticASEngine_2& withAntitheticVariate(bool b = true);
         MakeMCDiscreteArithmeticASEngine_2& withConstantParameters(bool b = true);
+        MakeMCDiscreteArithmeticASEngine_2& withShard(
+                            Size firstSample,
+                            Size endSample,
+                            Size blockSize = ShardRange::defaultBlockSize);
+        MakeMCDiscreteArithmeticASEngine_2& withProfiling(bool b = true);
+        MakeMCDiscreteArithmeticASEngine_2& withControlVariate(bool b = true);
+        MakeMCDiscreteArithmeticASEngine_2& withStratifiedSampling(
+                                                         Size strata = 64);
+        MakeMCDiscreteArithmeticASEngine_2& withMomentMatching(
+                                                      Size batchSize = 64);
+        MakeMCDiscreteArithmeticASEngine_2& withCheckpoint(
+                              const ext::shared_ptr<McCheckpoint>& checkpoint);
+        MakeMCDiscreteArithmeticASEngine_2& withCurveSensitivities(
+                                const std::vector<Date>& volatilityNodes);
+        MakeMCDiscreteArithmeticASEngine_2& withFittedParameters(bool b = true);
         // conversion to pricing engine
         operator ext::shared_ptr<PricingEngine>() const;
       private:
@@ -134,6 +1045,15 @@ namespace QuantLib {
         Real tolerance_;
         bool brownianBridge_ = true;
         BigNatural seed_ = 0;
+        bool constantParameters_ = false;
+        ShardRange shard_;
+        bool profiling_ = false;
+        bool controlVariate_ = false;
+        SamplingScheme sampling_;
+        ext::shared_ptr<McCheckpoint> checkpoint_;
+        bool curveSensitivities_ = false;
+        std::vector<Date> volatilityNodes_;
+        bool fittedParameters_ = false;
     };
 
     template <class RNG, class S>
@@ -195,6 +1115,72 @@ namespace QuantLib {
     template <class RNG, class S>
     inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
     MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withConstantParameters(bool b) {
+        constantParameters_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withShard(Size firstSample,
+                                                         Size endSample,
+                                                         Size blockSize) {
+        shard_ = ShardRange(firstSample, endSample, blockSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withProfiling(bool b) {
+        profiling_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withControlVariate(bool b) {
+        controlVariate_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withStratifiedSampling(
+                                                                Size strata) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::Stratified, strata);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withMomentMatching(
+                                                             Size batchSize) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::MomentMatched, batchSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withCheckpoint(
+                             const ext::shared_ptr<McCheckpoint>& checkpoint) {
+        checkpoint_ = checkpoint;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withCurveSensitivities(
+                                   const std::vector<Date>& volatilityNodes) {
+        curveSensitivities_ = true;
+        volatilityNodes_ = volatilityNodes;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCDiscreteArithmeticASEngine_2<RNG,S>&
+    MakeMCDiscreteArithmeticASEngine_2<RNG,S>::withFittedParameters(bool b) {
+        fittedParameters_ = b;
         return *this;
     }
 
@@ -208,9 +1194,35 @@ namespace QuantLib {
                                                       antithetic_,
                                                       samples_, tolerance_,
                                                       maxSamples_,
-                                                      seed_));
+                                                      seed_,
+                                                      constantParameters_,
+                                                      shard_,
+                                                      profiling_,
+                                                      controlVariate_,
+                                                      sampling_,
+                                                      checkpoint_,
+                                                      curveSensitivities_,
+                                                      volatilityNodes_,
+                                                      fittedParameters_));
     }
 
+
+    #ifndef QL_MC_ENGINES_HEADER_ONLY
+    // explicitly instantiated in mcengines.cpp
+    extern template class MCDiscreteArithmeticASEngine_2<PseudoRandom,Statistics>;
+    extern template class MCDiscreteArithmeticASBatch_2<PseudoRandom,Statistics>;
+    extern template class MakeMCDiscreteArithmeticASEngine_2<PseudoRandom,Statistics>;
+    extern template class MCDiscreteArithmeticASEngine_2<LowDiscrepancy,Statistics>;
+    extern template class MCDiscreteArithmeticASBatch_2<LowDiscrepancy,Statistics>;
+    extern template class MakeMCDiscreteArithmeticASEngine_2<LowDiscrepancy,Statistics>;
+    extern template McKernelResult mcAverageStrikeAsianKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const AverageStrikeAsianKernelParameters&,
+        const McKernelSettings&);
+    extern template McKernelResult mcAverageStrikeAsianKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const AverageStrikeAsianKernelParameters&,
+        const McKernelSettings&);
+    #endif
+
 }
 
 
@@ -26,11 +26,25 @@
 #ifndef mc_barrier_engines_hpp
 #define mc_barrier_engines_hpp
 
+#include "batchsampling.hpp"
+#include "constantblackscholesprocess.hpp"
+#include "controlvariate.hpp"
+#include "fusedpathsimulation.hpp"
+#include "importancesampling.hpp"
+#include "lazypathsimulation.hpp"
+#include "marketupdate.hpp"
+#include "mccheckpoint.hpp"
+#include "mckernel.hpp"
+#include "mcprofile.hpp"
+#include "mcsetupcache.hpp"
+#include "shardedsimulation.hpp"
+#include "typedpayoffs.hpp"
 #include <ql/exercise.hpp>
 #include <ql/instruments/barrieroption.hpp>
 #include <ql/pricingengines/mcsimulation.hpp>
 #include <ql/pricingengines/barrier/mcbarrierengine.hpp>
 #include <ql/processes/blackscholesprocess.hpp>
+#include <tuple>
 #include <utility>
 
 namespace QuantLib {
@@ -49,6 +63,100 @@ namespace QuantLib {
         Journal of Derivatives; Winter 1998; 6, 2; pg. 65-83
         </i>
 
+        If constant parameters are required, paths are generated with
+        a ConstantBlackScholesProcess extracted from the given process
+        at the exercise date; in this case, unless the biased pricer is
+        requested, the crossing probabilities between nodes are used
+        as weights (see ConditionalBarrierStepPricer) instead of being
+        sampled.
+
+        If early termination is required, paths are generated one step
+        at a time by a LazyPathSimulation: knock-out paths are not
+        simulated after the barrier is hit, and knock-in paths jump to
+        maturity in a single step.  This is available for the biased
+        pricer, or for the conditional one in constant mode; it is not
+        compatible with Brownian bridges, and requires pseudo-random
+        numbers.  The average number of steps simulated per path is
+        returned as the \c simulatedStepsPerPath additional result.
+        Since the fused simulation used by default in constant mode
+        computes the increments of all the steps together, early
+        termination is only faster when most paths are stopped well
+        before maturity; with barriers hit by few paths, it is
+        slower.
+
+        In constant mode, importance sampling can be required instead:
+        the drift of the Brownian motion is shifted by an amount
+        calibrated on a pilot run (see calibrateDriftShift()) so that
+        more paths reach the relevant region, and the payoffs are
+        weighted by the corresponding likelihood ratio.  The shift and
+        the variance reduction estimated on the pilot run are returned
+        as the \c driftShift and \c estimatedVarianceReduction
+        additional results.
+
+        The time grid, the discount factors, the constant process and
+        the path generator are kept across calculations and rebuilt
+        only when their inputs change (see McSetupCache.)
+
+        If a shard range is given, only the samples in the range are
+        simulated (see ShardRange) and the serialized state of the
+        shard is returned as the \c shardState additional result; the
+        states of the shards can be merged by mergeShards().  The
+        number of samples and the tolerance are not used in this case.
+
+        If profiling is enabled, the time spent in each phase of the
+        calculation and the number of paths and steps are returned
+        as \c profile.* additional results (see McProfile); the
+        times of the generation of the random numbers and of the
+        accumulation of the samples are estimates.  With early
+        termination, the payoff is evaluated during the evolution and
+        its time is included in the latter.
+
+        In constant mode, a control variate can be required: the
+        plain vanilla with the same strike and type is priced on the
+        terminal value of each path, and its Black price is used as
+        the known expectation (see ControlVariateSimulation.)  The
+        optimal coefficient is estimated during the simulation; it is
+        returned as the \c controlVariateCoefficient additional
+        result, and the ratio between the plain and the controlled
+        variance as \c controlVariateVarianceReduction.  This is not
+        compatible with early termination, importance sampling or
+        sharding.
+
+        Stratified or moment-matched sampling can be required instead
+        of plain sampling (see SamplingScheme); paths are then
+        simulated in batches by a BatchSampledSimulation.  This is not
+        compatible with early termination, control variates or
+        sharding, and requires pseudo-random numbers.
+
+        In constant mode, the paths are simulated by default by a
+        FusedPathSimulation, which feeds the same step pricers used
+        for early termination and evolves the logarithm of the
+        underlying and the barrier state together without building a
+        Path, with the same random sequences used by the path
+        generator; the results are the same up to rounding.  The
+        simulation is delegated to mcBarrierKernel(), which is passed
+        the discount factors of the risk-free curve at the nodes of
+        the time grid, so that knock-out rebates are discounted as
+        in the other modes.  Paths are still built if the fused
+        kernel is disabled or if early termination, importance
+        sampling, control variates, batch sampling, sharding or a
+        checkpoint are required.
+
+        If a checkpoint is given, the simulation is stored in it and
+        continued by later calculations with the same inputs, possibly
+        by a different engine requiring more samples or a tighter
+        tolerance (see McCheckpoint); the number of samples taken from
+        the checkpoint is returned as the \c reusedSamples additional
+        result.  This is only available with full paths and plain
+        sampling, i.e., not with early termination, importance
+        sampling, control variates, batch sampling, the fused kernel,
+        sharding or profiling.
+
+        Notifications from the process are forwarded to the
+        instruments only once between two calculations, since after
+        the first one they are already invalidated (see
+        NotificationGate and MarketUpdate.)
+
         \ingroup barrierengines
 
         \test the correctness of the returned value is tested by
@@ -75,32 +183,173 @@ namespace QuantLib {
                           Real requiredTolerance,
                           Size maxSamples,
                           bool isBiased,
-                          BigNatural seed);
+                          BigNatural seed,
+                          bool constantParameters,
+                          bool earlyTermination,
+                          bool importanceSampling,
+                          Size pilotSamples,
+                          const ShardRange& shard,
+                          bool profiling,
+                          bool controlVariate,
+                          const SamplingScheme& sampling,
+                          bool fusedKernel,
+                          ext::shared_ptr<McCheckpoint> checkpoint);
+        void update() override {
+            if (gate_.pass())
+                notifyObservers();
+        }
         void calculate() const override {
+            gate_.reset();
             Real spot = process_->x0();
             QL_REQUIRE(spot > 0.0, "negative or null underlying given");
             QL_REQUIRE(!triggered(spot), "barrier touched");
-            McSimulation<SingleVariate,RNG,S>::calculate(requiredTolerance_,
-                                                         requiredSamples_,
-                                                         maxSamples_);
-            results_.value = this->mcModel_->sampleAccumulator().mean();
-            if (RNG::allowsErrorEstimate)
-            results_.errorEstimate =
-                this->mcModel_->sampleAccumulator().errorEstimate();
+            profile_.reset();
+            if (fusedSimulation()) {
+                calculateWithKernel();
+                profile_.store(results_);
+                return;
+            }
+            if (earlyTermination_) {
+                {
+                    McProfile::Scope scope(profile_, McProfile::Setup);
+                    calculateWithStepPricer();
+                }
+                profile_.store(results_);
+                return;
+            }
+            if (importanceSampling_) {
+                McProfile::Scope scope(profile_, McProfile::Calibration);
+                calibrateDriftShift();
+            }
+            Size controlledSamples = 0, sampledPaths = 0;
+            if (controlVariate_) {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                controlledSamples = calculateWithControlVariate();
+            } else if (sampling_.active()) {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                sampledPaths = calculateWithSampling();
+            } else if (shard_.active()) {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                calculateShard();
+            } else if (checkpoint_) {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                calculateFromCheckpoint();
+            } else {
+                McProfile::Scope scope(profile_, McProfile::PathEvolution);
+                McSimulation<SingleVariate,RNG,S>::calculate(requiredTolerance_,
+                                                             requiredSamples_,
+                                                             maxSamples_);
+                results_.value = this->mcModel_->sampleAccumulator().mean();
+                if (RNG::allowsErrorEstimate)
+                results_.errorEstimate =
+                    this->mcModel_->sampleAccumulator().errorEstimate();
+            }
+            if (importanceSampling_) {
+                results_.additionalResults["driftShift"] =
+                    calibration_.shift;
+                results_.additionalResults["estimatedVarianceReduction"] =
+                    calibration_.varianceReduction;
+            }
+            if (profile_.enabled()) {
+                Size steps = timeGrid().size() - 1;
+                if (controlVariate_)
+                    estimateSimulationPhases<RNG,ControlVariateAccumulator>(
+                        profile_, controlledSamples, steps, steps,
+                        this->antitheticVariate_, seed_);
+                else if (sampling_.active())
+                    estimateSimulationPhases<RNG,S>(
+                        profile_, sampledPaths, steps, steps,
+                        this->antitheticVariate_, seed_);
+                else if (shard_.active())
+                    estimateSimulationPhases<RNG,AccumulatorState>(
+                        profile_, shard_.end - shard_.begin, steps, steps,
+                        this->antitheticVariate_, seed_);
+                else
+                    estimateSimulationPhases<RNG,S>(
+                        profile_, this->mcModel_->sampleAccumulator().samples(),
+                        steps, steps, this->antitheticVariate_, seed_);
+                profile_.store(results_);
+            }
         }
 
       protected:
         // McSimulation implementation
         TimeGrid timeGrid() const override;
         ext::shared_ptr<path_generator_type> pathGenerator() const override {
-            TimeGrid grid = timeGrid();
-            typename RNG::rsg_type gen =
-                RNG::make_sequence_generator(grid.size()-1,seed_);
-            return ext::shared_ptr<path_generator_type>(
-                         new path_generator_type(process_,
-                                                 grid, gen, brownianBridge_));
+            return pathGenerator(seed_);
+        }
+        ext::shared_ptr<path_generator_type> pathGenerator(BigNatural seed) const {
+            McProfile::Scope scope(profile_, McProfile::Setup);
+            return setup_.pathGenerator(simulatedProcess(), timeGrid(), seed,
+                                        brownianBridge_);
+        }
+        ext::shared_ptr<StochasticProcess1D> simulatedProcess() const;
+        ext::shared_ptr<path_pricer_type> pathPricer() const override {
+            // the seed used by the QuantLib engine
+            return pathPricer(5);
         }
-        ext::shared_ptr<path_pricer_type> pathPricer() const override;
+        /*! the seed is used by the pricer sampling the barrier
+            crossings with non-constant parameters.
+        */
+        ext::shared_ptr<path_pricer_type> pathPricer(
+                                              BigNatural crossingSeed) const;
+        ext::shared_ptr<path_pricer_type> payoffPricer(
+                                              BigNatural crossingSeed) const;
+        ext::shared_ptr<ConstantBlackScholesProcess> constantProcess() const;
+        std::vector<DiscountFactor> discounts(const TimeGrid& grid) const;
+        // lazy simulation
+        void calculateWithStepPricer() const;
+        template <class StepPricer>
+        void simulateLazily(const ext::shared_ptr<StochasticProcess1D>&,
+                            const TimeGrid& grid,
+                            const StepPricer& pricer) const;
+        // fused simulation
+        bool fusedSimulation() const;
+        void calculateWithKernel() const;
+        // importance sampling
+        void calibrateDriftShift() const;
+        // sharding
+        void calculateShard() const;
+        // checkpointed simulation
+        McCheckpointKey checkpointKey() const;
+        void calculateFromCheckpoint() const;
+        // control variate; returns the number of samples
+        Size calculateWithControlVariate() const;
+        // batch sampling; returns the number of paths
+        Size calculateWithSampling() const;
+        // specializations on barrier and option type
+        template <Barrier::Type BarrierType, Option::Type Type>
+        ext::shared_ptr<path_pricer_type> typedPathPricer(
+                                              BigNatural crossingSeed) const;
+        template <Barrier::Type BarrierType, Option::Type Type>
+        void typedStepCalculation() const;
+        class PathPricerFactory {
+          public:
+            typedef ext::shared_ptr<path_pricer_type> result_type;
+            PathPricerFactory(const MCBarrierEngine_2* engine,
+                              BigNatural crossingSeed)
+            : engine_(engine), crossingSeed_(crossingSeed) {}
+            template <Barrier::Type BarrierType, Option::Type Type>
+            result_type apply() const {
+                return engine_->template typedPathPricer<BarrierType,Type>(
+                                                              crossingSeed_);
+            }
+          private:
+            const MCBarrierEngine_2* engine_;
+            BigNatural crossingSeed_;
+        };
+        class StepCalculation {
+          public:
+            typedef void result_type;
+            explicit StepCalculation(const MCBarrierEngine_2* engine)
+            : engine_(engine) {}
+            template <Barrier::Type BarrierType, Option::Type Type>
+            void apply() const {
+                engine_->template typedStepCalculation<BarrierType,Type>();
+            }
+          private:
+            const MCBarrierEngine_2* engine_;
+        };
         // data members
         ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
         Size timeSteps_, timeStepsPerYear_;
@@ -109,6 +358,19 @@ namespace QuantLib {
         bool isBiased_;
         bool brownianBridge_;
         BigNatural seed_;
+        bool constantParameters_;
+        bool earlyTermination_;
+        bool importanceSampling_;
+        Size pilotSamples_;
+        mutable DriftShiftCalibration calibration_;
+        ShardRange shard_;
+        mutable McSetupCache<RNG> setup_;
+        mutable McProfile profile_;
+        bool controlVariate_;
+        SamplingScheme sampling_;
+        bool fusedKernel_;
+        ext::shared_ptr<McCheckpoint> checkpoint_;
+        mutable NotificationGate gate_;
     };
 
 
@@ -128,16 +390,241 @@ namespace QuantLib {
         MakeMCBarrierEngine_2& withBias(bool b = true);
         MakeMCBarrierEngine_2& withSeed(BigNatural seed);
         MakeMCBarrierEngine_2& withConstantParameters(bool b = true);
+        MakeMCBarrierEngine_2& withEarlyTermination(bool b = true);
+        MakeMCBarrierEngine_2& withImportanceSampling(bool b = true);
+        MakeMCBarrierEngine_2& withPilotSamples(Size samples);
+        MakeMCBarrierEngine_2& withShard(
+                            Size firstSample,
+                            Size endSample,
+                            Size blockSize = ShardRange::defaultBlockSize);
+        MakeMCBarrierEngine_2& withProfiling(bool b = true);
+        MakeMCBarrierEngine_2& withControlVariate(bool b = true);
+        MakeMCBarrierEngine_2& withStratifiedSampling(Size strata = 64);
+        MakeMCBarrierEngine_2& withMomentMatching(Size batchSize = 64);
+        MakeMCBarrierEngine_2& withFusedKernel(bool b = true);
+        MakeMCBarrierEngine_2& withCheckpoint(
+                              const ext::shared_ptr<McCheckpoint>& checkpoint);
         // conversion to pricing engine
         operator ext::shared_ptr<PricingEngine>() const;
       private:
         ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
         bool brownianBridge_ = false, antithetic_ = false, biased_ = false;
+        bool constantParameters_ = false, earlyTermination_ = false;
+        bool importanceSampling_ = false, profiling_ = false;
+        bool controlVariate_ = false, fusedKernel_ = true;
         Size steps_, stepsPerYear_, samples_, maxSamples_;
+        Size pilotSamples_ = 10000;
         Real tolerance_;
         BigNatural seed_ = 0;
+        ShardRange shard_;
+        SamplingScheme sampling_;
+        ext::shared_ptr<McCheckpoint> checkpoint_;
+    };
+
+
+    //! Step pricer for barrier options monitored at the grid nodes
+    /*! This pricer reproduces BiasedBarrierPathPricer; the barrier
+        and option types are template parameters, so that no branching
+        on them is performed at each step.
+
+        \ingroup steppricers
+    */
+    template <Barrier::Type BarrierType, Option::Type Type>
+    class BiasedBarrierStepPricer {
+      public:
+        BiasedBarrierStepPricer(Real barrier,
+                                Real rebate,
+                                Real strike,
+                                std::vector<DiscountFactor> discounts);
+        void start(Real x0);
+        PathStatus::Type step(Size i, Real x);
+        PathStatus::Type logStep(Size i, Real y);
+        Real value(Real x) const;
+      private:
+        typedef BarrierTraits<BarrierType> traits;
+        PathStatus::Type knock(Size i);
+        Real barrier_, logBarrier_;
+        Real rebate_;
+        TypedVanillaPayoff<Type> payoff_;
+        std::vector<DiscountFactor> discounts_;
+        Size knockNode_;
+    };
+
+    //! Path pricer for barrier options monitored at the grid nodes
+    template <Barrier::Type BarrierType, Option::Type Type>
+    using BiasedBarrierPathPricer_2 =
+        StepPathPricer<BiasedBarrierStepPricer<BarrierType, Type> >;
+
+
+    //! Step pricer for barrier options using conditional crossing probabilities
+    /*! Given the values \f$ S_i \f$ and \f$ S_{i+1} \f$ of the
+        underlying at two consecutive nodes, the probability that a
+        Brownian bridge with constant volatility \f$ \sigma \f$ did
+        not touch the barrier \f$ H \f$ in between is
+        \f[
+            p_i = 1 - \exp\left(-\frac{2 \ln(S_i/H) \ln(S_{i+1}/H)}
+                                       {\sigma^2 \Delta t_i}\right)
+        \f]
+        if both values are on the starting side of the barrier, and
+        null otherwise.  Instead of sampling the crossing as
+        BarrierPathPricer does, this pricer weights the payoff and the
+        rebate with the resulting survival and knock probabilities.
+        The result is the conditional expectation of the sampled
+        estimator; it has the same mean, lower variance and doesn't
+        need a second random sequence.
+
+        As in BarrierPathPricer, knock-out rebates are paid at the
+        node following the crossing and knock-in rebates at maturity.
+
+        \ingroup steppricers
+    */
+    template <Barrier::Type BarrierType, Option::Type Type>
+    class ConditionalBarrierStepPricer {
+      public:
+        ConditionalBarrierStepPricer(Real barrier,
+                                     Real rebate,
+                                     Real strike,
+                                     std::vector<DiscountFactor> discounts,
+                                     Volatility volatility,
+                                     const TimeGrid& grid);
+        void start(Real x0);
+        PathStatus::Type step(Size i, Real x) {
+            return logStep(i, std::log(x));
+        }
+        PathStatus::Type logStep(Size i, Real y);
+        Real value(Real x) const;
+      private:
+        typedef BarrierTraits<BarrierType> traits;
+        Real logBarrier_;
+        Real rebate_;
+        TypedVanillaPayoff<Type> payoff_;
+        std::vector<DiscountFactor> discounts_;
+        std::vector<Real> factors_;
+        // path state
+        Real distance_, survival_, knockOutRebate_;
     };
 
+    //! Path pricer using conditional crossing probabilities
+    template <Barrier::Type BarrierType, Option::Type Type>
+    using ConditionalBarrierPathPricer =
+        StepPathPricer<ConditionalBarrierStepPricer<BarrierType, Type> >;
+
+
+    //! Path pricer sampling the barrier crossing between nodes
+    /*! This pricer reproduces BarrierPathPricer, with the barrier and
+        option types as template parameters.  The loop stops at the
+        node where the barrier is crossed, since the rest of the path
+        is no longer relevant; one uniform sequence is still drawn for
+        each path, so the results are unchanged.
+    */
+    template <Barrier::Type BarrierType, Option::Type Type>
+    class BarrierPathPricer_2 : public PathPricer<Path> {
+      public:
+        BarrierPathPricer_2(Real barrier,
+                            Real rebate,
+                            Real strike,
+                            std::vector<DiscountFactor> discounts,
+                            ext::shared_ptr<StochasticProcess1D> diffProcess,
+                            PseudoRandom::ursg_type sequenceGen);
+        Real operator()(const Path& path) const override;
+      private:
+        typedef BarrierTraits<BarrierType> traits;
+        Real barrier_;
+        Real rebate_;
+        ext::shared_ptr<StochasticProcess1D> diffProcess_;
+        mutable PseudoRandom::ursg_type sequenceGen_;
+        TypedVanillaPayoff<Type> payoff_;
+        std::vector<DiscountFactor> discounts_;
+    };
+
+
+    //! barrier option priced by mcBarrierKernel()
+    /*! \ingroup mckernels */
+    struct BarrierKernelParameters {
+        Barrier::Type barrierType = Barrier::DownOut;
+        Real barrier = Null<Real>();
+        Real rebate = 0.0;
+        Option::Type type = Option::Call;
+        Real strike = Null<Real>();
+        Time maturity = Null<Time>();
+        //! whether the barrier is only monitored at the grid nodes
+        bool biased = false;
+        //! discount factors at the nodes of the time grid
+        /*! If empty, the rebates and payoffs are discounted at the
+            constant risk-free rate.
+        */
+        std::vector<DiscountFactor> discounts;
+    };
+
+    //! stateless Monte Carlo pricing of a barrier option
+    /*! The paths are simulated by a FusedPathSimulation with a
+        BiasedBarrierStepPricer or, unless the biased pricer is
+        requested, a ConditionalBarrierStepPricer; the results are
+        those of MCBarrierEngine_2 with constant parameters and the
+        fused kernel.  Rebates are discounted with the given discount
+        factors or, if none are passed, at the constant risk-free
+        rate.  See \ref mckernels.
+
+        \ingroup mckernels
+    */
+    template <class RNG = PseudoRandom, class S = Statistics>
+    McKernelResult mcBarrierKernel(const BlackScholesParameters& market,
+                                   const BarrierKernelParameters& option,
+                                   const McKernelSettings& settings);
+
+    namespace detail {
+
+        template <class RNG, class S>
+        class BarrierKernelCalculation {
+          public:
+            typedef McKernelResult result_type;
+            BarrierKernelCalculation(
+                const ext::shared_ptr<ConstantBlackScholesProcess>& process,
+                const TimeGrid& grid,
+                const BarrierKernelParameters& option,
+                const McKernelSettings& settings)
+            : process_(process), grid_(grid), option_(option),
+              settings_(settings) {}
+            template <Barrier::Type BarrierType, Option::Type Type>
+            result_type apply() const {
+                std::vector<DiscountFactor> discounts = option_.discounts;
+                if (discounts.empty()) {
+                    discounts.resize(grid_.size());
+                    for (Size i=0; i<grid_.size(); i++)
+                        discounts[i] = process_->discount(grid_[i]);
+                }
+                QL_REQUIRE(discounts.size() == grid_.size(),
+                           discounts.size() << " discount factors given, "
+                           << grid_.size() << " grid nodes required");
+                if (option_.biased)
+                    return simulate(BiasedBarrierStepPricer<BarrierType,Type>(
+                        option_.barrier, option_.rebate, option_.strike,
+                        discounts));
+                else
+                    return simulate(
+                        ConditionalBarrierStepPricer<BarrierType,Type>(
+                            option_.barrier, option_.rebate, option_.strike,
+                            discounts, process_->volatility(), grid_));
+            }
+          private:
+            template <class StepPricer>
+            result_type simulate(const StepPricer& pricer) const {
+                FusedPathSimulation<RNG,StepPricer,S> simulation(
+                    process_, grid_, pricer, settings_.brownianBridge,
+                    settings_.antitheticVariate, settings_.seed);
+                simulation.calculate(settings_.requiredTolerance,
+                                     settings_.requiredSamples,
+                                     settings_.maxSamples);
+                return kernelResult<RNG>(simulation.sampleAccumulator());
+            }
+            const ext::shared_ptr<ConstantBlackScholesProcess>& process_;
+            const TimeGrid& grid_;
+            const BarrierKernelParameters& option_;
+            const McKernelSettings& settings_;
+        };
+
+    }
+
 
     // template definitions
 
@@ -152,11 +639,26 @@ namespace QuantLib {
         Real requiredTolerance,
         Size maxSamples,
         bool isBiased,
-        BigNatural seed)
+        BigNatural seed,
+        bool constantParameters,
+        bool earlyTermination,
+        bool importanceSampling,
+        Size pilotSamples,
+        const ShardRange& shard,
+        bool profiling,
+        bool controlVariate,
+        const SamplingScheme& sampling,
+        bool fusedKernel,
+        ext::shared_ptr<McCheckpoint> checkpoint)
     : McSimulation<SingleVariate, RNG, S>(antitheticVariate, false), process_(std::move(process)),
       timeSteps_(timeSteps), timeStepsPerYear_(timeStepsPerYear), requiredSamples_(requiredSamples),
       maxSamples_(maxSamples), requiredTolerance_(requiredTolerance), isBiased_(isBiased),
-      brownianBridge_(brownianBridge), seed_(seed) {
+      brownianBridge_(brownianBridge), seed_(seed), constantParameters_(constantParameters),
+      earlyTermination_(earlyTermination), importanceSampling_(importanceSampling),
+      pilotSamples_(pilotSamples), shard_(shard), setup_(process_),
+      profile_(profiling), controlVariate_(controlVariate),
+      sampling_(sampling), fusedKernel_(fusedKernel),
+      checkpoint_(std::move(checkpoint)) {
         QL_REQUIRE(timeSteps != Null<Size>() ||
                    timeStepsPerYear != Null<Size>(),
                    "no time steps provided");
@@ -169,6 +671,55 @@ namespace QuantLib {
         QL_REQUIRE(timeStepsPerYear != 0,
                    "timeStepsPerYear must be positive, " << timeStepsPerYear <<
                    " not allowed");
+        if (earlyTermination) {
+            QL_REQUIRE(RNG::allowsErrorEstimate,
+                       "early termination requires pseudo-random numbers");
+            QL_REQUIRE(!brownianBridge,
+                       "Brownian bridge not compatible with early termination");
+            QL_REQUIRE(isBiased || constantParameters,
+                       "early termination requires either the biased pricer "
+                       "or constant parameters");
+        }
+        if (importanceSampling) {
+            QL_REQUIRE(constantParameters,
+                       "importance sampling requires constant parameters");
+            QL_REQUIRE(!earlyTermination,
+                       "importance sampling not compatible with early termination");
+        }
+        if (shard.active()) {
+            QL_REQUIRE(RNG::allowsErrorEstimate,
+                       "sharding requires pseudo-random numbers");
+            QL_REQUIRE(!earlyTermination,
+                       "sharding not compatible with early termination");
+        }
+        if (controlVariate) {
+            QL_REQUIRE(constantParameters,
+                       "control variate requires constant parameters");
+            QL_REQUIRE(!earlyTermination,
+                       "control variate not compatible with early termination");
+            QL_REQUIRE(!importanceSampling,
+                       "control variate not compatible with importance sampling");
+            QL_REQUIRE(!shard.active(),
+                       "control variate not compatible with sharding");
+        }
+        if (sampling.active()) {
+            QL_REQUIRE(RNG::allowsErrorEstimate,
+                       "stratified or moment-matched sampling requires "
+                       "pseudo-random numbers");
+            QL_REQUIRE(!earlyTermination && !controlVariate && !shard.active(),
+                       "stratified or moment-matched sampling not compatible "
+                       "with early termination, control variates or sharding");
+        }
+        if (checkpoint_) {
+            QL_REQUIRE(!earlyTermination && !importanceSampling &&
+                       !controlVariate && !sampling.active() &&
+                       !shard.active() && !profiling,
+                       "checkpoint not compatible with early termination, "
+                       "importance sampling, control variates, batch "
+                       "sampling, sharding or profiling");
+        }
+        calibration_.shift = 0.0;
+        calibration_.varianceReduction = Null<Real>();
         registerWith(process_);
     }
 
@@ -176,51 +727,91 @@ namespace QuantLib {
     inline TimeGrid MCBarrierEngine_2<RNG,S>::timeGrid() const {
 
         Time residualTime = process_->time(arguments_.exercise->lastDate());
-        if (timeSteps_ != Null<Size>()) {
-            return TimeGrid(residualTime, timeSteps_);
-        } else if (timeStepsPerYear_ != Null<Size>()) {
-            Size steps = static_cast<Size>(timeStepsPerYear_*residualTime);
-            return TimeGrid(residualTime, std::max<Size>(steps, 1));
-        } else {
-            QL_FAIL("time steps not specified");
-        }
+        return setup_.timeGrid(residualTime, timeSteps_, timeStepsPerYear_);
+    }
+
+
+    template <class RNG, class S>
+    inline ext::shared_ptr<StochasticProcess1D>
+    MCBarrierEngine_2<RNG,S>::simulatedProcess() const {
+        if (importanceSampling_)
+            return shiftedProcess(constantProcess(), calibration_.shift);
+        else if (constantParameters_)
+            return constantProcess();
+        else
+            return process_;
     }
 
 
     template <class RNG, class S>
     inline
     ext::shared_ptr<typename MCBarrierEngine_2<RNG,S>::path_pricer_type>
-    MCBarrierEngine_2<RNG,S>::pathPricer() const {
+    MCBarrierEngine_2<RNG,S>::pathPricer(BigNatural crossingSeed) const {
+        McProfile::Scope scope(profile_, McProfile::Setup);
+        ext::shared_ptr<path_pricer_type> pricer = payoffPricer(crossingSeed);
+        if (importanceSampling_)
+            pricer = ext::make_shared<LikelihoodRatioPathPricer>(
+                pricer, constantProcess(), calibration_.shift);
+        if (profile_.enabled())
+            pricer = ext::make_shared<ProfiledPathPricer>(pricer, profile_);
+        return pricer;
+    }
+
+
+    template <class RNG, class S>
+    inline
+    ext::shared_ptr<typename MCBarrierEngine_2<RNG,S>::path_pricer_type>
+    MCBarrierEngine_2<RNG,S>::payoffPricer(BigNatural crossingSeed) const {
         ext::shared_ptr<PlainVanillaPayoff> payoff =
             ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
         QL_REQUIRE(payoff, "non-plain payoff given");
 
+        // the types are resolved here once, instead of in each path
+        return dispatchBarrierType(arguments_.barrierType,
+                                   payoff->optionType(),
+                                   PathPricerFactory(this, crossingSeed));
+    }
+
+
+    template <class RNG, class S>
+    template <Barrier::Type BarrierType, Option::Type Type>
+    inline
+    ext::shared_ptr<typename MCBarrierEngine_2<RNG,S>::path_pricer_type>
+    MCBarrierEngine_2<RNG,S>::typedPathPricer(BigNatural crossingSeed) const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+
         TimeGrid grid = timeGrid();
-        std::vector<DiscountFactor> discounts(grid.size());
-        for (Size i=0; i<grid.size(); i++)
-            discounts[i] = process_->riskFreeRate()->discount(grid[i]);
+        std::vector<DiscountFactor> discounts = this->discounts(grid);
 
-        // do this with template parameters?
         if (isBiased_) {
             return ext::shared_ptr<
                         typename MCBarrierEngine_2<RNG,S>::path_pricer_type>(
-                new BiasedBarrierPathPricer(
-                       arguments_.barrierType,
+                new BiasedBarrierPathPricer_2<BarrierType,Type>(
+                    BiasedBarrierStepPricer<BarrierType,Type>(
                        arguments_.barrier,
                        arguments_.rebate,
-                       payoff->optionType(),
                        payoff->strike(),
-                       discounts));
+                       discounts)));
+        } else if (constantParameters_) {
+            return ext::shared_ptr<
+                        typename MCBarrierEngine_2<RNG,S>::path_pricer_type>(
+                new ConditionalBarrierPathPricer<BarrierType,Type>(
+                    ConditionalBarrierStepPricer<BarrierType,Type>(
+                       arguments_.barrier,
+                       arguments_.rebate,
+                       payoff->strike(),
+                       discounts,
+                       constantProcess()->volatility(),
+                       grid)));
         } else {
-            PseudoRandom::ursg_type sequenceGen(grid.size()-1,
-                                                PseudoRandom::urng_type(5));
+            PseudoRandom::ursg_type sequenceGen(
+                grid.size()-1, PseudoRandom::urng_type(crossingSeed));
             return ext::shared_ptr<
                         typename MCBarrierEngine_2<RNG,S>::path_pricer_type>(
-                new BarrierPathPricer(
-                    arguments_.barrierType,
+                new BarrierPathPricer_2<BarrierType,Type>(
                     arguments_.barrier,
                     arguments_.rebate,
-                    payoff->optionType(),
                     payoff->strike(),
                     discounts,
                     process_,
@@ -229,6 +820,294 @@ namespace QuantLib {
     }
 
 
+    template <class RNG, class S>
+    inline ext::shared_ptr<ConstantBlackScholesProcess>
+    MCBarrierEngine_2<RNG,S>::constantProcess() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        return setup_.constantProcess(arguments_.exercise->lastDate(),
+                                      payoff->strike());
+    }
+
+
+    template <class RNG, class S>
+    inline std::vector<DiscountFactor>
+    MCBarrierEngine_2<RNG,S>::discounts(const TimeGrid& grid) const {
+        return setup_.discounts(grid);
+    }
+
+
+    template <class RNG, class S>
+    inline void MCBarrierEngine_2<RNG,S>::calculateWithStepPricer() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        dispatchBarrierType(arguments_.barrierType, payoff->optionType(),
+                            StepCalculation(this));
+    }
+
+
+    template <class RNG, class S>
+    template <Barrier::Type BarrierType, Option::Type Type>
+    inline void MCBarrierEngine_2<RNG,S>::typedStepCalculation() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+
+        TimeGrid grid = timeGrid();
+
+        if (isBiased_) {
+            ext::shared_ptr<StochasticProcess1D> process = process_;
+            if (constantParameters_)
+                process = constantProcess();
+            simulateLazily(process, grid,
+                           BiasedBarrierStepPricer<BarrierType,Type>(
+                               arguments_.barrier,
+                               arguments_.rebate,
+                               payoff->strike(),
+                               discounts(grid)));
+        } else {
+            ext::shared_ptr<ConstantBlackScholesProcess> process =
+                constantProcess();
+            simulateLazily(process, grid,
+                           ConditionalBarrierStepPricer<BarrierType,Type>(
+                               arguments_.barrier,
+                               arguments_.rebate,
+                               payoff->strike(),
+                               discounts(grid),
+                               process->volatility(),
+                               grid));
+        }
+    }
+
+
+    template <class RNG, class S>
+    inline void MCBarrierEngine_2<RNG,S>::calibrateDriftShift() const {
+        // the pilot uses a different seed to keep it independent
+        BigNatural pilotSeed = seed_ == 0 ? 0 : seed_ + 1;
+        calibration_ = QuantLib::calibrateDriftShift<RNG>(constantProcess(),
+                                                          timeGrid(),
+                                                          *payoffPricer(5),
+                                                          pilotSamples_,
+                                                          pilotSeed);
+    }
+
+
+    template <class RNG, class S>
+    inline void MCBarrierEngine_2<RNG,S>::calculateShard() const {
+        // the pricer is rebuilt for each block, since the one sampling
+        // the barrier crossings keeps the state of its own generator;
+        // the latter is seeded from the block seed, so that the blocks
+        // don't replay the same crossing uniforms
+        ShardState state = simulateShard(
+            seed_, shard_,
+            [this](BigNatural seed, Size samples) {
+                BigNatural crossingSeed = seed ^ 0x5bd1e995U;
+                return simulatePaths<RNG>(
+                    pathGenerator(seed),
+                    pathPricer(crossingSeed != 0 ? crossingSeed : 1),
+                    this->antitheticVariate_, samples);
+            });
+        storeShardResults(state, results_);
+    }
+
+
+    template <class RNG, class S>
+    inline McCheckpointKey MCBarrierEngine_2<RNG,S>::checkpointKey() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        McCheckpointKey key("MCBarrierEngine_2");
+        key.add<const void*>(process_.get());
+        key.add<BigNatural>(seed_);
+        key.add<bool>(brownianBridge_);
+        key.add<bool>(this->antitheticVariate_);
+        key.add<bool>(constantParameters_);
+        key.add<bool>(isBiased_);
+        key.add(timeGrid());
+        key.add<int>(arguments_.barrierType);
+        key.add<int>(payoff->optionType());
+        key.add<Real>(payoff->strike());
+        key.add<Real>(arguments_.barrier);
+        key.add<Real>(arguments_.rebate);
+        return key;
+    }
+
+
+    template <class RNG, class S>
+    inline void MCBarrierEngine_2<RNG,S>::calculateFromCheckpoint() const {
+        typedef ModelSimulation<RNG,S> simulation_type;
+        Size reusedSamples;
+        const simulation_type& simulation =
+            extendSimulation<simulation_type>(
+                *checkpoint_, checkpointKey(), process_,
+                [this]() {
+                    // a new generator, since the one in the set-up
+                    // cache is reset by later calculations
+                    TimeGrid grid = timeGrid();
+                    typename RNG::rsg_type rsg =
+                        RNG::make_sequence_generator(grid.size()-1, seed_);
+                    return simulation_type(
+                        ext::make_shared<
+                            typename simulation_type::model_type>(
+                                ext::make_shared<path_generator_type>(
+                                    simulatedProcess(), grid, rsg,
+                                    brownianBridge_),
+                                pathPricer(), S(),
+                                this->antitheticVariate_));
+                },
+                requiredTolerance_, requiredSamples_, maxSamples_,
+                reusedSamples);
+        this->mcModel_ = simulation.model();
+        results_.value = this->mcModel_->sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            results_.errorEstimate =
+                this->mcModel_->sampleAccumulator().errorEstimate();
+        results_.additionalResults["reusedSamples"] = reusedSamples;
+    }
+
+
+    template <class RNG, class S>
+    inline Size MCBarrierEngine_2<RNG,S>::calculateWithControlVariate() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        ext::shared_ptr<path_pricer_type> controlPricer;
+        Real controlValue;
+        {
+            McProfile::Scope scope(profile_, McProfile::Setup);
+            TimeGrid grid = timeGrid();
+            std::tie(controlPricer, controlValue) =
+                terminalVanillaControl(constantProcess(),
+                                       payoff->optionType(),
+                                       payoff->strike(),
+                                       grid.back(),
+                                       discounts(grid).back());
+            if (profile_.enabled())
+                controlPricer =
+                    ext::make_shared<ProfiledPathPricer>(controlPricer,
+                                                         profile_);
+        }
+
+        ControlVariateSimulation<RNG> simulation(pathGenerator(),
+                                                 pathPricer(),
+                                                 controlPricer,
+                                                 controlValue,
+                                                 this->antitheticVariate_);
+        simulation.calculate(requiredTolerance_, requiredSamples_,
+                             maxSamples_);
+        results_.value = simulation.value();
+        if (RNG::allowsErrorEstimate)
+            results_.errorEstimate = simulation.errorEstimate();
+        results_.additionalResults["controlVariateCoefficient"] =
+            simulation.accumulator().coefficient();
+        results_.additionalResults["controlVariateVarianceReduction"] =
+            simulation.accumulator().varianceReduction();
+        return simulation.samples();
+    }
+
+
+    template <class RNG, class S>
+    inline Size MCBarrierEngine_2<RNG,S>::calculateWithSampling() const {
+        BatchSampledSimulation<RNG,S> simulation(simulatedProcess(),
+                                                 timeGrid(),
+                                                 pathPricer(),
+                                                 brownianBridge_,
+                                                 this->antitheticVariate_,
+                                                 sampling_,
+                                                 seed_);
+        simulation.calculate(requiredTolerance_, requiredSamples_,
+                             maxSamples_);
+        results_.value = simulation.sampleAccumulator().mean();
+        results_.errorEstimate =
+            simulation.sampleAccumulator().errorEstimate();
+        return simulation.samples();
+    }
+
+
+    template <class RNG, class S>
+    inline bool MCBarrierEngine_2<RNG,S>::fusedSimulation() const {
+        return fusedKernel_ && constantParameters_ && !earlyTermination_ &&
+               !importanceSampling_ && !controlVariate_ &&
+               !sampling_.active() && !shard_.active() && !checkpoint_;
+    }
+
+
+    template <class RNG, class S>
+    inline void MCBarrierEngine_2<RNG,S>::calculateWithKernel() const {
+        ext::shared_ptr<PlainVanillaPayoff> payoff =
+            ext::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        BarrierKernelParameters option;
+        option.barrierType = arguments_.barrierType;
+        option.barrier = arguments_.barrier;
+        option.rebate = arguments_.rebate;
+        option.type = payoff->optionType();
+        option.strike = payoff->strike();
+        option.maturity = timeGrid().back();
+        option.biased = isBiased_;
+        option.discounts = discounts(timeGrid());
+
+        McKernelSettings settings;
+        settings.timeSteps = timeGrid().size() - 1;
+        settings.requiredSamples = requiredSamples_;
+        settings.requiredTolerance = requiredTolerance_;
+        settings.maxSamples = maxSamples_;
+        settings.seed = seed_;
+        settings.antitheticVariate = this->antitheticVariate_;
+        settings.brownianBridge = brownianBridge_;
+
+        BlackScholesParameters market;
+        {
+            McProfile::Scope scope(profile_, McProfile::Setup);
+            market = blackScholesParameters(*constantProcess());
+        }
+        McKernelResult result;
+        {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            result = mcBarrierKernel<RNG,S>(market, option, settings);
+        }
+        estimateSimulationPhases<RNG,S>(profile_, result.samples,
+                                        settings.timeSteps, settings.timeSteps,
+                                        this->antitheticVariate_, seed_);
+        results_.value = result.value;
+        if (RNG::allowsErrorEstimate)
+            results_.errorEstimate = result.errorEstimate;
+    }
+
+
+    template <class RNG, class S>
+    template <class StepPricer>
+    inline void MCBarrierEngine_2<RNG,S>::simulateLazily(
+                       const ext::shared_ptr<StochasticProcess1D>& process,
+                       const TimeGrid& grid,
+                       const StepPricer& pricer) const {
+        LazyPathSimulation<StepPricer,S> simulation(process, grid, pricer,
+                                                    this->antitheticVariate_,
+                                                    seed_);
+        {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            simulation.calculate(requiredTolerance_, requiredSamples_,
+                                 maxSamples_);
+        }
+        estimateSimulationPhases<RNG,S>(profile_, simulation.samples(),
+                                        grid.size()-1,
+                                        simulation.stepsPerPath(),
+                                        this->antitheticVariate_, seed_);
+        results_.value = simulation.sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            results_.errorEstimate =
+                simulation.sampleAccumulator().errorEstimate();
+        results_.additionalResults["simulatedStepsPerPath"] =
+            simulation.stepsPerPath();
+    }
+
+
     template <class RNG, class S>
     inline MakeMCBarrierEngine_2<RNG, S>::MakeMCBarrierEngine_2(
         ext::shared_ptr<GeneralizedBlackScholesProcess> process)
@@ -308,6 +1187,82 @@ namespace QuantLib {
     template <class RNG, class S>
     inline MakeMCBarrierEngine_2<RNG,S>&
     MakeMCBarrierEngine_2<RNG,S>::withConstantParameters(bool b) {
+        constantParameters_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withEarlyTermination(bool b) {
+        earlyTermination_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withImportanceSampling(bool b) {
+        importanceSampling_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withPilotSamples(Size samples) {
+        pilotSamples_ = samples;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withShard(Size firstSample,
+                                            Size endSample,
+                                            Size blockSize) {
+        shard_ = ShardRange(firstSample, endSample, blockSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withProfiling(bool b) {
+        profiling_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withControlVariate(bool b) {
+        controlVariate_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withStratifiedSampling(Size strata) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::Stratified, strata);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withMomentMatching(Size batchSize) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::MomentMatched, batchSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withFusedKernel(bool b) {
+        fusedKernel_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCBarrierEngine_2<RNG,S>&
+    MakeMCBarrierEngine_2<RNG,S>::withCheckpoint(
+                             const ext::shared_ptr<McCheckpoint>& checkpoint) {
+        checkpoint_ = checkpoint;
         return *this;
     }
 
@@ -327,9 +1282,224 @@ namespace QuantLib {
                                      samples_, tolerance_,
                                      maxSamples_,
                                      biased_,
-                                     seed_));
+                                     seed_,
+                                     constantParameters_,
+                                     earlyTermination_,
+                                     importanceSampling_,
+                                     pilotSamples_,
+                                     shard_,
+                                     profiling_,
+                                     controlVariate_,
+                                     sampling_,
+                                     fusedKernel_,
+                                     checkpoint_));
+    }
+
+
+    template <Barrier::Type B, Option::Type T>
+    inline BiasedBarrierStepPricer<B,T>::BiasedBarrierStepPricer(
+                                        Real barrier,
+                                        Real rebate,
+                                        Real strike,
+                                        std::vector<DiscountFactor> discounts)
+    : barrier_(barrier),
+      logBarrier_(barrier > 0.0 ? std::log(barrier) : -QL_MAX_REAL),
+      rebate_(rebate), payoff_(strike),
+      discounts_(std::move(discounts)), knockNode_(Null<Size>()) {
+        QL_REQUIRE(strike>=0.0,
+                   "strike less than zero not allowed");
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline void BiasedBarrierStepPricer<B,T>::start(Real) {
+        knockNode_ = Null<Size>();
     }
 
+    template <Barrier::Type B, Option::Type T>
+    inline PathStatus::Type BiasedBarrierStepPricer<B,T>::step(Size i,
+                                                               Real x) {
+        if (!traits::triggered(x, barrier_))
+            return PathStatus::Alive;
+        return knock(i);
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline PathStatus::Type BiasedBarrierStepPricer<B,T>::logStep(Size i,
+                                                                  Real y) {
+        if (!traits::triggered(y, logBarrier_))
+            return PathStatus::Alive;
+        return knock(i);
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline PathStatus::Type BiasedBarrierStepPricer<B,T>::knock(Size i) {
+        knockNode_ = i+1;
+        return traits::knockIn ? PathStatus::TerminalOnly
+                               : PathStatus::Finished;
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline Real BiasedBarrierStepPricer<B,T>::value(Real x) const {
+        bool knocked = (knockNode_ != Null<Size>());
+        if (traits::knockIn)
+            return knocked ? payoff_(x) * discounts_.back()
+                           : rebate_ * discounts_.back();
+        else
+            return knocked ? rebate_ * discounts_[knockNode_]
+                           : payoff_(x) * discounts_.back();
+    }
+
+
+    template <Barrier::Type B, Option::Type T>
+    inline ConditionalBarrierStepPricer<B,T>::ConditionalBarrierStepPricer(
+                                        Real barrier,
+                                        Real rebate,
+                                        Real strike,
+                                        std::vector<DiscountFactor> discounts,
+                                        Volatility volatility,
+                                        const TimeGrid& grid)
+    : rebate_(rebate), payoff_(strike),
+      discounts_(std::move(discounts)), factors_(grid.size()-1),
+      distance_(0.0), survival_(1.0), knockOutRebate_(0.0) {
+        QL_REQUIRE(barrier>0.0,
+                   "barrier less/equal zero not allowed");
+        QL_REQUIRE(strike>=0.0,
+                   "strike less than zero not allowed");
+        QL_REQUIRE(discounts_.size() == grid.size(),
+                   "wrong number of discount factors");
+        logBarrier_ = std::log(barrier);
+        for (Size i=0; i<factors_.size(); i++)
+            factors_[i] = 2.0/(volatility*volatility*grid.dt(i));
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline void ConditionalBarrierStepPricer<B,T>::start(Real x0) {
+        // log-distance from the barrier, positive on the starting side
+        distance_ = traits::up ? logBarrier_ - std::log(x0)
+                               : std::log(x0) - logBarrier_;
+        survival_ = 1.0;
+        knockOutRebate_ = 0.0;
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline PathStatus::Type
+    ConditionalBarrierStepPricer<B,T>::logStep(Size i, Real y) {
+        Real next = traits::up ? logBarrier_ - y : y - logBarrier_;
+        // probability of not touching the barrier during the step
+        Real p = 0.0;
+        if (distance_ > 0.0 && next > 0.0)
+            p = 1.0 - std::exp(-distance_*next*factors_[i]);
+        knockOutRebate_ += survival_*(1.0-p)*discounts_[i+1];
+        survival_ *= p;
+        distance_ = next;
+        if (survival_ > 0.0)
+            return PathStatus::Alive;
+        return traits::knockIn ? PathStatus::TerminalOnly
+                               : PathStatus::Finished;
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline Real ConditionalBarrierStepPricer<B,T>::value(Real x) const {
+        Real payoff = payoff_(x) * discounts_.back();
+        if (traits::knockIn)
+            return payoff*(1.0-survival_) +
+                rebate_*discounts_.back()*survival_;
+        else
+            return payoff*survival_ + rebate_*knockOutRebate_;
+    }
+
+
+    template <Barrier::Type B, Option::Type T>
+    inline BarrierPathPricer_2<B,T>::BarrierPathPricer_2(
+                             Real barrier,
+                             Real rebate,
+                             Real strike,
+                             std::vector<DiscountFactor> discounts,
+                             ext::shared_ptr<StochasticProcess1D> diffProcess,
+                             PseudoRandom::ursg_type sequenceGen)
+    : barrier_(barrier), rebate_(rebate), diffProcess_(std::move(diffProcess)),
+      sequenceGen_(std::move(sequenceGen)), payoff_(strike),
+      discounts_(std::move(discounts)) {
+        QL_REQUIRE(strike>=0.0,
+                   "strike less than zero not allowed");
+        QL_REQUIRE(barrier>0.0,
+                   "barrier less/equal zero not allowed");
+    }
+
+    template <Barrier::Type B, Option::Type T>
+    inline Real BarrierPathPricer_2<B,T>::operator()(const Path& path) const {
+        Size n = path.length();
+        QL_REQUIRE(n>1, "the path cannot be empty");
+
+        const TimeGrid& timeGrid = path.timeGrid();
+        const std::vector<Real>& u = sequenceGen_.nextSequence().value;
+
+        Real asset_price = path.front();
+        Size knockNode = Null<Size>();
+        for (Size i = 0; i < n-1; i++) {
+            Real new_asset_price = path[i+1];
+            Volatility vol = diffProcess_->diffusion(timeGrid[i],asset_price);
+            Time dt = timeGrid.dt(i);
+            // extremum of the Brownian bridge between the nodes
+            Real x = std::log(new_asset_price / asset_price);
+            Real y = traits::up ?
+                0.5*(x + std::sqrt(x*x - 2*vol*vol*dt*std::log((1-u[i])))) :
+                0.5*(x - std::sqrt(x*x - 2*vol*vol*dt*std::log(u[i])));
+            if (traits::triggered(asset_price * std::exp(y), barrier_)) {
+                knockNode = i+1;
+                break;
+            }
+            asset_price = new_asset_price;
+        }
+
+        bool knocked = (knockNode != Null<Size>());
+        if (traits::knockIn)
+            return knocked ? payoff_(path.back()) * discounts_.back()
+                           : rebate_ * discounts_.back();
+        else
+            return knocked ? rebate_ * discounts_[knockNode]
+                           : payoff_(asset_price) * discounts_.back();
+    }
+
+
+    template <class RNG, class S>
+    inline McKernelResult mcBarrierKernel(
+                                        const BlackScholesParameters& market,
+                                        const BarrierKernelParameters& option,
+                                        const McKernelSettings& settings) {
+        QL_REQUIRE(option.barrier != Null<Real>() && option.barrier > 0.0,
+                   "positive barrier required");
+        QL_REQUIRE(option.strike != Null<Real>() && option.strike >= 0.0,
+                   "non-negative strike required");
+        ext::shared_ptr<ConstantBlackScholesProcess> process =
+            detail::kernelProcess(market);
+        bool up = (option.barrierType == Barrier::UpIn ||
+                   option.barrierType == Barrier::UpOut);
+        QL_REQUIRE(up ? market.spot < option.barrier
+                      : market.spot > option.barrier,
+                   "barrier touched");
+        TimeGrid grid = detail::kernelTimeGrid(option.maturity, settings);
+        return dispatchBarrierType(
+            option.barrierType, option.type,
+            detail::BarrierKernelCalculation<RNG,S>(process, grid, option,
+                                                    settings));
+    }
+
+
+    #ifndef QL_MC_ENGINES_HEADER_ONLY
+    // explicitly instantiated in mcengines.cpp
+    extern template class MCBarrierEngine_2<PseudoRandom,Statistics>;
+    extern template class MakeMCBarrierEngine_2<PseudoRandom,Statistics>;
+    extern template class MCBarrierEngine_2<LowDiscrepancy,Statistics>;
+    extern template class MakeMCBarrierEngine_2<LowDiscrepancy,Statistics>;
+    extern template McKernelResult mcBarrierKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const BarrierKernelParameters&,
+        const McKernelSettings&);
+    extern template McKernelResult mcBarrierKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const BarrierKernelParameters&,
+        const McKernelSettings&);
+    #endif
+
 }
 
 
@@ -0,0 +1,184 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file mccheckpoint.hpp
+    \brief Simulations kept across calculations and extended on request
+*/
+
+#ifndef mc_checkpoint_hpp
+#define mc_checkpoint_hpp
+
+#include "mcsetupcache.hpp"
+#include "samplecontrol.hpp"
+#include "shardedsimulation.hpp"
+#include <ql/methods/montecarlo/montecarlomodel.hpp>
+#include <ql/patterns/observable.hpp>
+#include <ql/timegrid.hpp>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace QuantLib {
+
+    //! inputs identifying a simulation kept in a checkpoint
+    /*! Engines add to the key whatever determines the paths and the
+        payoffs (seed, grid, flags, instrument data); two calculations
+        with the same key and no change in the market can share the
+        same stream of samples.
+    */
+    class McCheckpointKey {
+      public:
+        explicit McCheckpointKey(const std::string& engine) : data_(engine) {}
+        template <class T>
+        McCheckpointKey& add(T value) {
+            detail::writeBinary<T>(data_, value);
+            return *this;
+        }
+        McCheckpointKey& add(const TimeGrid& grid) {
+            add<Size>(grid.size());
+            for (Time t : grid)
+                add<Time>(t);
+            return *this;
+        }
+        const std::string& data() const { return data_; }
+      private:
+        std::string data_;
+    };
+
+
+    //! simulation kept across calculations
+    /*! An engine given a checkpoint stores in it the simulation it
+        runs, including the state of its random-number generator and
+        of its accumulator.  A later calculation with the same key (see
+        McCheckpointKey) continues the stored simulation instead of
+        starting a new one; thus, an engine created with a larger
+        number of samples or a tighter tolerance and the same
+        checkpoint only simulates the additional samples, and its
+        results are exactly those of a single run with the same seed
+        and the same total number of samples.
+
+        The stored simulation is discarded, and a new one is started,
+        when the key changes, when the observed market (usually the
+        process) notifies a change, or when fewer samples than those
+        already simulated are required.
+
+        The checkpoint only lives in memory.  To continue a simulation
+        in a different process, use sharding instead: the state of the
+        samples \f$ [0, n) \f$ returned by an engine (see ShardState)
+        can be merged with that of the samples \f$ [n, m) \f$ simulated
+        later, with the same result as a single shard \f$ [0, m) \f$.
+    */
+    class McCheckpoint {
+      public:
+        McCheckpoint() = default;
+        McCheckpoint(const McCheckpoint&) = delete;
+        McCheckpoint& operator=(const McCheckpoint&) = delete;
+        //! the stored simulation, if it has the given key and type
+        template <class Simulation>
+        Simulation* find(const McCheckpointKey& key) const;
+        //! stores a new simulation, replacing the previous one
+        template <class Simulation>
+        Simulation& store(const McCheckpointKey& key,
+                          const ext::shared_ptr<Observable>& market,
+                          Simulation simulation);
+        //! discards the stored simulation
+        void clear();
+        bool empty() const { return !simulation_; }
+      private:
+        struct Holder {
+            virtual ~Holder() = default;
+        };
+        template <class Simulation>
+        struct TypedHolder : Holder {
+            explicit TypedHolder(Simulation s) : simulation(std::move(s)) {}
+            Simulation simulation;
+        };
+        std::unique_ptr<Holder> simulation_;
+        std::string key_;
+        ChangeFlag marketChanged_;
+    };
+
+
+    //! runs a simulation to target, continuing the one in the checkpoint
+    /*! If the checkpoint contains a simulation with the given key that
+        can reach the target, it is extended; otherwise, a new one is
+        created by <tt>makeSimulation()</tt> and stored.  The
+        simulation must provide the interface required by
+        simulateToTarget().  The number of samples taken from the
+        checkpoint is returned in \c reusedSamples.
+    */
+    template <class Simulation, class F>
+    Simulation& extendSimulation(McCheckpoint& checkpoint,
+                                 const McCheckpointKey& key,
+                                 const ext::shared_ptr<Observable>& market,
+                                 const F& makeSimulation,
+                                 Real requiredTolerance,
+                                 Size requiredSamples,
+                                 Size maxSamples,
+                                 Size& reusedSamples) {
+        Simulation* simulation = checkpoint.find<Simulation>(key);
+        if (simulation != nullptr && requiredTolerance == Null<Real>() &&
+            simulation->samples() > requiredSamples)
+            simulation = nullptr;
+        if (simulation == nullptr)
+            simulation = &checkpoint.store(key, market, makeSimulation());
+        reusedSamples = simulation->samples();
+        simulateToTarget(*simulation, requiredTolerance, requiredSamples,
+                         maxSamples);
+        return *simulation;
+    }
+
+
+    //! Monte Carlo model driven by simulateToTarget()
+    template <class RNG, class S>
+    class ModelSimulation {
+      public:
+        typedef MonteCarloModel<SingleVariate,RNG,S> model_type;
+        explicit ModelSimulation(ext::shared_ptr<model_type> model)
+        : model_(std::move(model)) {}
+        void addSamples(Size samples) { model_->addSamples(samples); }
+        Size samples() const {
+            return model_->sampleAccumulator().samples();
+        }
+        Real errorEstimate() const {
+            return model_->sampleAccumulator().errorEstimate();
+        }
+        const ext::shared_ptr<model_type>& model() const { return model_; }
+      private:
+        ext::shared_ptr<model_type> model_;
+    };
+
+
+    // inline definitions
+
+    template <class Simulation>
+    inline Simulation* McCheckpoint::find(const McCheckpointKey& key) const {
+        if (!simulation_ || marketChanged_.raised() || key.data() != key_)
+            return nullptr;
+        auto holder = dynamic_cast<TypedHolder<Simulation>*>(simulation_.get());
+        return holder != nullptr ? &holder->simulation : nullptr;
+    }
+
+    template <class Simulation>
+    inline Simulation& McCheckpoint::store(
+                                    const McCheckpointKey& key,
+                                    const ext::shared_ptr<Observable>& market,
+                                    Simulation simulation) {
+        auto holder = new TypedHolder<Simulation>(std::move(simulation));
+        simulation_.reset(holder);
+        key_ = key.data();
+        marketChanged_.unregisterWithAll();
+        marketChanged_.registerWith(market);
+        marketChanged_.lower();
+        return holder->simulation;
+    }
+
+    inline void McCheckpoint::clear() {
+        simulation_.reset();
+        key_.clear();
+        marketChanged_.unregisterWithAll();
+    }
+
+}
+
+
+#endif
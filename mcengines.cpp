@@ -0,0 +1,51 @@
+
+/*  Explicit instantiations of the Monte Carlo engines and kernels for the most
+    common random-number and statistics policies.  The headers declare
+    them as extern templates, so that the translation units including
+    them don't instantiate them again; define QL_MC_ENGINES_HEADER_ONLY
+    to use the headers without linking this file.
+*/
+
+#include "mc_discr_arith_av_strike.hpp"
+#include "mcbarrierengine.hpp"
+#include "mceuropeanengine.hpp"
+
+namespace QuantLib {
+
+    template class MCEuropeanEngine_2<PseudoRandom,Statistics>;
+    template class MakeMCEuropeanEngine_2<PseudoRandom,Statistics>;
+    template class MCDiscreteArithmeticASEngine_2<PseudoRandom,Statistics>;
+    template class MCDiscreteArithmeticASBatch_2<PseudoRandom,Statistics>;
+    template class MakeMCDiscreteArithmeticASEngine_2<PseudoRandom,Statistics>;
+    template class MCBarrierEngine_2<PseudoRandom,Statistics>;
+    template class MakeMCBarrierEngine_2<PseudoRandom,Statistics>;
+
+    template class MCEuropeanEngine_2<LowDiscrepancy,Statistics>;
+    template class MakeMCEuropeanEngine_2<LowDiscrepancy,Statistics>;
+    template class MCDiscreteArithmeticASEngine_2<LowDiscrepancy,Statistics>;
+    template class MCDiscreteArithmeticASBatch_2<LowDiscrepancy,Statistics>;
+    template class MakeMCDiscreteArithmeticASEngine_2<LowDiscrepancy,Statistics>;
+    template class MCBarrierEngine_2<LowDiscrepancy,Statistics>;
+    template class MakeMCBarrierEngine_2<LowDiscrepancy,Statistics>;
+
+    template McKernelResult mcEuropeanKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const EuropeanKernelParameters&,
+        const McKernelSettings&);
+    template McKernelResult mcAverageStrikeAsianKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const AverageStrikeAsianKernelParameters&,
+        const McKernelSettings&);
+    template McKernelResult mcBarrierKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const BarrierKernelParameters&,
+        const McKernelSettings&);
+
+    template McKernelResult mcEuropeanKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const EuropeanKernelParameters&,
+        const McKernelSettings&);
+    template McKernelResult mcAverageStrikeAsianKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const AverageStrikeAsianKernelParameters&,
+        const McKernelSettings&);
+    template McKernelResult mcBarrierKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const BarrierKernelParameters&,
+        const McKernelSettings&);
+
+}
@@ -26,6 +26,18 @@
 #ifndef montecarlo_european_engine_hpp
 #define montecarlo_european_engine_hpp
 
+#include "batchsampling.hpp"
+#include "constantblackscholesprocess.hpp"
+#include "curvesensitivities.hpp"
+#include "fusedpathsimulation.hpp"
+#include "importancesampling.hpp"
+#include "marketupdate.hpp"
+#include "mccheckpoint.hpp"
+#include "mckernel.hpp"
+#include "mcprofile.hpp"
+#include "mcsetupcache.hpp"
+#include "shardedsimulation.hpp"
+#include "typedpayoffs.hpp"
 #include <ql/pricingengines/vanilla/mcvanillaengine.hpp>
 #include <ql/processes/blackscholesprocess.hpp>
 #include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
@@ -34,7 +46,72 @@
 namespace QuantLib {
 
     //! European option pricing engine using Monte Carlo simulation
-    /*! \ingroup vanillaengines
+    /*! If constant parameters are required, paths are generated with
+        a ConstantBlackScholesProcess extracted from the given process
+        at the exercise date.
+
+        In constant mode, importance sampling can also be required: the
+        drift of the Brownian motion is shifted by an amount calibrated
+        on a pilot run (see calibrateDriftShift()) and the payoffs are
+        weighted by the corresponding likelihood ratio.  The shift and
+        the variance reduction estimated on the pilot run are returned
+        as the \c driftShift and \c estimatedVarianceReduction
+        additional results.
+
+        The time grid, the constant process and the path generator are
+        kept across calculations and rebuilt only when their inputs
+        change (see McSetupCache.)
+
+        If a shard range is given, only the samples in the range are
+        simulated (see ShardRange) and the serialized state of the
+        shard is returned as the \c shardState additional result; the
+        states of the shards can be merged by mergeShards().  The
+        number of samples and the tolerance are not used in this case.
+
+        If profiling is enabled, the time spent in each phase of the
+        calculation and the number of paths and steps are returned
+        as \c profile.* additional results (see McProfile); the
+        times of the generation of the random numbers and of the
+        accumulation of the samples are estimates.
+
+        Stratified or moment-matched sampling can be required instead
+        of plain sampling (see SamplingScheme); paths are then
+        simulated in batches by a BatchSampledSimulation.  This is not
+        compatible with sharding, and requires pseudo-random numbers.
+
+        In constant mode, the paths are simulated by default by a
+        FusedPathSimulation, which only keeps the logarithm of the
+        underlying instead of building a Path; the results are the
+        same up to rounding.  Paths are still built if the fused
+        kernel is disabled or if importance sampling, sharding or
+        batch sampling are required.  Unless a checkpoint is also
+        given, the fused simulation is delegated to
+        mcEuropeanKernel().
+
+        If a checkpoint is given, the simulation is stored in it and
+        continued by later calculations with the same inputs, possibly
+        by a different engine requiring more samples or a tighter
+        tolerance (see McCheckpoint); the number of samples taken from
+        the checkpoint is returned as the \c reusedSamples additional
+        result.  This is not compatible with importance sampling,
+        sharding, batch sampling or profiling.
+
+        In non-constant mode, the sensitivities of the value to the
+        zero rates at the nodes of the risk-free curve, which must be a
+        ZeroCurve, and to the volatilities of the Black curve at the
+        given dates can be required; they are computed in the same
+        simulation as the value by an adjoint path pricer (see
+        CurveAdjointPathPricer) and returned as the
+        \c zeroRateSensitivities and \c volatilitySensitivities
+        additional results.  This is not compatible with importance
+        sampling, sharding, batch sampling, checkpoints or profiling.
+
+        Notifications from the process are forwarded to the
+        instruments only once between two calculations, since after
+        the first one they are already invalidated (see
+        NotificationGate and MarketUpdate.)
+
+        \ingroup vanillaengines
 
         \test the correctness of the returned value is tested by
               checking it against analytic results.
@@ -60,9 +137,65 @@ namespace QuantLib {
              Size requiredSamples,
              Real requiredTolerance,
              Size maxSamples,
-             BigNatural seed);
+             BigNatural seed,
+             bool constantParameters,
+             bool importanceSampling,
+             Size pilotSamples,
+             const ShardRange& shard,
+             bool profiling,
+             const SamplingScheme& sampling,
+             bool fusedKernel,
+             boost::shared_ptr<McCheckpoint> checkpoint,
+             bool curveSensitivities,
+             std::vector<Date> volatilityNodes);
+        void calculate() const;
+        void update();
       protected:
+        TimeGrid timeGrid() const;
+        boost::shared_ptr<path_generator_type> pathGenerator() const;
+        boost::shared_ptr<path_generator_type> pathGenerator(
+                                                      BigNatural seed) const;
         boost::shared_ptr<path_pricer_type> pathPricer() const;
+        boost::shared_ptr<StochasticProcess1D> simulatedProcess() const;
+        boost::shared_ptr<ConstantBlackScholesProcess> constantProcess() const;
+        boost::shared_ptr<path_pricer_type> payoffPricer() const;
+        DiscountFactor discount() const;
+        // checkpointed simulation
+        McCheckpointKey checkpointKey() const;
+        void calculateFromCheckpoint() const;
+        // adjoint curve sensitivities
+        void calculateCurveSensitivities() const;
+        // fused kernel; returns the number of samples
+        bool fusedSimulation() const;
+        Size calculateFused() const;
+        McKernelSettings kernelSettings() const;
+        template <Option::Type Type>
+        Size typedFusedCalculation() const;
+        class FusedCalculation {
+          public:
+            typedef Size result_type;
+            explicit FusedCalculation(const MCEuropeanEngine_2* engine)
+            : engine_(engine) {}
+            template <Option::Type Type>
+            Size apply() const {
+                return engine_->template typedFusedCalculation<Type>();
+            }
+          private:
+            const MCEuropeanEngine_2* engine_;
+        };
+        bool constantParameters_;
+        bool importanceSampling_;
+        Size pilotSamples_;
+        mutable DriftShiftCalibration calibration_;
+        ShardRange shard_;
+        mutable McSetupCache<RNG> setup_;
+        mutable McProfile profile_;
+        SamplingScheme sampling_;
+        bool fusedKernel_;
+        boost::shared_ptr<McCheckpoint> checkpoint_;
+        bool curveSensitivities_;
+        std::vector<Date> volatilityNodes_;
+        mutable NotificationGate gate_;
     };
 
     //! Monte Carlo European engine factory
@@ -81,6 +214,20 @@ namespace QuantLib {
         MakeMCEuropeanEngine_2& withSeed(BigNatural seed);
         MakeMCEuropeanEngine_2& withAntitheticVariate(bool b = true);
         MakeMCEuropeanEngine_2& withConstantParameters(bool b = true);
+        MakeMCEuropeanEngine_2& withImportanceSampling(bool b = true);
+        MakeMCEuropeanEngine_2& withPilotSamples(Size samples);
+        MakeMCEuropeanEngine_2& withShard(
+                            Size firstSample,
+                            Size endSample,
+                            Size blockSize = ShardRange::defaultBlockSize);
+        MakeMCEuropeanEngine_2& withProfiling(bool b = true);
+        MakeMCEuropeanEngine_2& withStratifiedSampling(Size strata = 64);
+        MakeMCEuropeanEngine_2& withMomentMatching(Size batchSize = 64);
+        MakeMCEuropeanEngine_2& withFusedKernel(bool b = true);
+        MakeMCEuropeanEngine_2& withCheckpoint(
+                            const boost::shared_ptr<McCheckpoint>& checkpoint);
+        MakeMCEuropeanEngine_2& withCurveSensitivities(
+                                const std::vector<Date>& volatilityNodes);
         // conversion to pricing engine
         operator boost::shared_ptr<PricingEngine>() const;
       private:
@@ -90,19 +237,162 @@ namespace QuantLib {
         Real tolerance_;
         bool brownianBridge_;
         BigNatural seed_;
+        bool constantParameters_;
+        bool importanceSampling_;
+        Size pilotSamples_;
+        ShardRange shard_;
+        bool profiling_;
+        SamplingScheme sampling_;
+        bool fusedKernel_;
+        boost::shared_ptr<McCheckpoint> checkpoint_;
+        bool curveSensitivities_;
+        std::vector<Date> volatilityNodes_;
     };
 
+    //! European path pricer specialized on the option type
+    template <Option::Type Type>
     class EuropeanPathPricer_2 : public PathPricer<Path> {
       public:
-        EuropeanPathPricer_2(Option::Type type,
-                             Real strike,
+        EuropeanPathPricer_2(Real strike,
                              DiscountFactor discount);
         Real operator()(const Path& path) const;
       private:
-        PlainVanillaPayoff payoff_;
+        TypedVanillaPayoff<Type> payoff_;
+        DiscountFactor discount_;
+    };
+
+    //! European step pricer specialized on the option type
+    /*! Only the value at maturity is needed, so the pricer doesn't
+        ask for any step after the first.
+
+        \ingroup steppricers
+    */
+    template <Option::Type Type>
+    class EuropeanStepPricer {
+      public:
+        EuropeanStepPricer(Real strike,
+                           DiscountFactor discount);
+        void start(Real) {}
+        PathStatus::Type step(Size, Real) { return PathStatus::TerminalOnly; }
+        PathStatus::Type logStep(Size, Real) {
+            return PathStatus::TerminalOnly;
+        }
+        Real value(Real x) const { return payoff_(x) * discount_; }
+      private:
+        TypedVanillaPayoff<Type> payoff_;
         DiscountFactor discount_;
     };
 
+    //! European adjoint path pricer specialized on the option type
+    template <Option::Type Type>
+    class EuropeanAdjointPathPricer : public CurveAdjointPathPricer {
+      public:
+        EuropeanAdjointPathPricer(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const TimeGrid& grid,
+             Real strike);
+      protected:
+        Real payoff(const Path& path,
+                    std::vector<Real>& gradient) const override {
+            gradient.back() = payoff_.derivative(path.back());
+            return payoff_(path.back());
+        }
+      private:
+        TypedVanillaPayoff<Type> payoff_;
+    };
+
+    //! European option priced by mcEuropeanKernel()
+    /*! \ingroup mckernels */
+    struct EuropeanKernelParameters {
+        Option::Type type = Option::Call;
+        Real strike = Null<Real>();
+        Time maturity = Null<Time>();
+    };
+
+    //! stateless Monte Carlo pricing of a European option
+    /*! The paths are simulated by a FusedPathSimulation with a
+        EuropeanStepPricer; the results are those of
+        MCEuropeanEngine_2 with constant parameters and the fused
+        kernel.  See \ref mckernels.
+
+        \ingroup mckernels
+    */
+    template <class RNG = PseudoRandom, class S = Statistics>
+    McKernelResult mcEuropeanKernel(const BlackScholesParameters& market,
+                                    const EuropeanKernelParameters& option,
+                                    const McKernelSettings& settings);
+
+    namespace detail {
+
+        template <class RNG, class S>
+        class EuropeanKernelCalculation {
+          public:
+            typedef McKernelResult result_type;
+            EuropeanKernelCalculation(
+                const boost::shared_ptr<ConstantBlackScholesProcess>& process,
+                const TimeGrid& grid,
+                Real strike,
+                const McKernelSettings& settings)
+            : process_(process), grid_(grid), strike_(strike),
+              settings_(settings) {}
+            template <Option::Type Type>
+            result_type apply() const {
+                FusedPathSimulation<RNG,EuropeanStepPricer<Type>,S> simulation(
+                    process_, grid_,
+                    EuropeanStepPricer<Type>(strike_,
+                                             process_->discount(grid_.back())),
+                    settings_.brownianBridge, settings_.antitheticVariate,
+                    settings_.seed);
+                simulation.calculate(settings_.requiredTolerance,
+                                     settings_.requiredSamples,
+                                     settings_.maxSamples);
+                return kernelResult<RNG>(simulation.sampleAccumulator());
+            }
+          private:
+            const boost::shared_ptr<ConstantBlackScholesProcess>& process_;
+            const TimeGrid& grid_;
+            Real strike_;
+            const McKernelSettings& settings_;
+        };
+
+        class EuropeanAdjointPathPricerFactory {
+          public:
+            typedef boost::shared_ptr<CurveAdjointPathPricer> result_type;
+            EuropeanAdjointPathPricerFactory(
+                boost::shared_ptr<GeneralizedBlackScholesProcess> process,
+                TimeGrid grid,
+                Real strike)
+            : process_(std::move(process)), grid_(std::move(grid)),
+              strike_(strike) {}
+            template <Option::Type Type>
+            result_type apply() const {
+                return result_type(
+                    new EuropeanAdjointPathPricer<Type>(process_, grid_,
+                                                        strike_));
+            }
+          private:
+            boost::shared_ptr<GeneralizedBlackScholesProcess> process_;
+            TimeGrid grid_;
+            Real strike_;
+        };
+
+        class EuropeanPathPricerFactory {
+          public:
+            typedef boost::shared_ptr<PathPricer<Path> > result_type;
+            EuropeanPathPricerFactory(Real strike, DiscountFactor discount)
+            : strike_(strike), discount_(discount) {}
+            template <Option::Type Type>
+            result_type apply() const {
+                return result_type(
+                    new EuropeanPathPricer_2<Type>(strike_, discount_));
+            }
+          private:
+            Real strike_;
+            DiscountFactor discount_;
+        };
+
+    }
+
 
     // inline definitions
 
@@ -117,7 +407,17 @@ namespace QuantLib {
              Size requiredSamples,
              Real requiredTolerance,
              Size maxSamples,
-             BigNatural seed)
+             BigNatural seed,
+             bool constantParameters,
+             bool importanceSampling,
+             Size pilotSamples,
+             const ShardRange& shard,
+             bool profiling,
+             const SamplingScheme& sampling,
+             bool fusedKernel,
+             boost::shared_ptr<McCheckpoint> checkpoint,
+             bool curveSensitivities,
+             std::vector<Date> volatilityNodes)
     : MCVanillaEngine<SingleVariate,RNG,S>(process,
                                            timeSteps,
                                            timeStepsPerYear,
@@ -127,7 +427,170 @@ namespace QuantLib {
                                            requiredSamples,
                                            requiredTolerance,
                                            maxSamples,
-                                           seed) {}
+                                           seed),
+      constantParameters_(constantParameters),
+      importanceSampling_(importanceSampling), pilotSamples_(pilotSamples),
+      shard_(shard), setup_(process), profile_(profiling),
+      sampling_(sampling), fusedKernel_(fusedKernel),
+      checkpoint_(std::move(checkpoint)),
+      curveSensitivities_(curveSensitivities),
+      volatilityNodes_(std::move(volatilityNodes)) {
+        QL_REQUIRE(!importanceSampling || constantParameters,
+                   "importance sampling requires constant parameters");
+        QL_REQUIRE(!shard.active() || RNG::allowsErrorEstimate,
+                   "sharding requires pseudo-random numbers");
+        if (sampling.active()) {
+            QL_REQUIRE(RNG::allowsErrorEstimate,
+                       "stratified or moment-matched sampling requires "
+                       "pseudo-random numbers");
+            QL_REQUIRE(!shard.active(),
+                       "stratified or moment-matched sampling "
+                       "not compatible with sharding");
+        }
+        if (checkpoint_) {
+            QL_REQUIRE(!importanceSampling && !shard.active() &&
+                       !sampling.active() && !profiling,
+                       "checkpoint not compatible with importance "
+                       "sampling, sharding, batch sampling or profiling");
+        }
+        if (curveSensitivities) {
+            QL_REQUIRE(!constantParameters,
+                       "curve sensitivities not available "
+                       "with constant parameters");
+            QL_REQUIRE(!shard.active() && !sampling.active() &&
+                       !checkpoint_ && !profiling,
+                       "curve sensitivities not compatible with sharding, "
+                       "batch sampling, checkpoints or profiling");
+        }
+        calibration_.shift = 0.0;
+        calibration_.varianceReduction = Null<Real>();
+    }
+
+
+    template <class RNG, class S>
+    inline void MCEuropeanEngine_2<RNG,S>::update() {
+        if (gate_.pass())
+            this->notifyObservers();
+    }
+
+    template <class RNG, class S>
+    inline void MCEuropeanEngine_2<RNG,S>::calculate() const {
+        gate_.reset();
+        profile_.reset();
+        if (importanceSampling_) {
+            McProfile::Scope scope(profile_, McProfile::Calibration);
+            // the pilot uses a different seed to keep it independent
+            BigNatural pilotSeed = this->seed_ == 0 ? 0 : this->seed_ + 1;
+            calibration_ = calibrateDriftShift<RNG>(constantProcess(),
+                                                    this->timeGrid(),
+                                                    *payoffPricer(),
+                                                    pilotSamples_,
+                                                    pilotSeed);
+        }
+        Size sampledPaths = 0;
+        if (fusedSimulation()) {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            sampledPaths = calculateFused();
+        } else if (sampling_.active()) {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            BatchSampledSimulation<RNG,S> simulation(simulatedProcess(),
+                                                     this->timeGrid(),
+                                                     this->pathPricer(),
+                                                     this->brownianBridge_,
+                                                     this->antitheticVariate_,
+                                                     sampling_,
+                                                     this->seed_);
+            simulation.calculate(this->requiredTolerance_,
+                                 this->requiredSamples_,
+                                 this->maxSamples_);
+            this->results_.value = simulation.sampleAccumulator().mean();
+            this->results_.errorEstimate =
+                simulation.sampleAccumulator().errorEstimate();
+            sampledPaths = simulation.samples();
+        } else if (shard_.active()) {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            ShardState state = simulateShard(
+                this->seed_, shard_,
+                [this](BigNatural seed, Size samples) {
+                    return simulatePaths<RNG>(pathGenerator(seed),
+                                              this->pathPricer(),
+                                              this->antitheticVariate_,
+                                              samples);
+                });
+            storeShardResults(state, this->results_);
+        } else if (checkpoint_) {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            calculateFromCheckpoint();
+        } else if (curveSensitivities_) {
+            calculateCurveSensitivities();
+        } else {
+            McProfile::Scope scope(profile_, McProfile::PathEvolution);
+            MCVanillaEngine<SingleVariate,RNG,S>::calculate();
+        }
+        if (importanceSampling_) {
+            this->results_.additionalResults["driftShift"] =
+                calibration_.shift;
+            this->results_.additionalResults["estimatedVarianceReduction"] =
+                calibration_.varianceReduction;
+        }
+        if (profile_.enabled()) {
+            Size steps = this->timeGrid().size() - 1;
+            if (fusedSimulation() || sampling_.active())
+                estimateSimulationPhases<RNG,S>(
+                    profile_, sampledPaths, steps, steps,
+                    this->antitheticVariate_, this->seed_);
+            else if (shard_.active())
+                estimateSimulationPhases<RNG,AccumulatorState>(
+                    profile_, shard_.end - shard_.begin, steps, steps,
+                    this->antitheticVariate_, this->seed_);
+            else
+                estimateSimulationPhases<RNG,S>(
+                    profile_, this->mcModel_->sampleAccumulator().samples(),
+                    steps, steps, this->antitheticVariate_, this->seed_);
+            profile_.store(this->results_);
+        }
+    }
+
+
+    template <class RNG, class S>
+    inline TimeGrid MCEuropeanEngine_2<RNG,S>::timeGrid() const {
+        Time maturity =
+            this->process_->time(this->arguments_.exercise->lastDate());
+        return setup_.timeGrid(maturity, this->timeSteps_,
+                               this->timeStepsPerYear_);
+    }
+
+
+    template <class RNG, class S>
+    inline
+    boost::shared_ptr<typename MCEuropeanEngine_2<RNG,S>::path_generator_type>
+    MCEuropeanEngine_2<RNG,S>::pathGenerator() const {
+        return pathGenerator(this->seed_);
+    }
+
+
+    template <class RNG, class S>
+    inline
+    boost::shared_ptr<typename MCEuropeanEngine_2<RNG,S>::path_generator_type>
+    MCEuropeanEngine_2<RNG,S>::pathGenerator(BigNatural seed) const {
+
+        McProfile::Scope scope(profile_, McProfile::Setup);
+        return setup_.pathGenerator(simulatedProcess(), this->timeGrid(),
+                                    seed, this->brownianBridge_);
+    }
+
+
+    template <class RNG, class S>
+    inline boost::shared_ptr<StochasticProcess1D>
+    MCEuropeanEngine_2<RNG,S>::simulatedProcess() const {
+        if (importanceSampling_)
+            return shiftedProcess(constantProcess(), calibration_.shift);
+        else if (constantParameters_)
+            return constantProcess();
+        else
+            return boost::dynamic_pointer_cast<StochasticProcess1D>(
+                                                             this->process_);
+    }
 
 
     template <class RNG, class S>
@@ -135,22 +598,254 @@ namespace QuantLib {
     boost::shared_ptr<typename MCEuropeanEngine_2<RNG,S>::path_pricer_type>
     MCEuropeanEngine_2<RNG,S>::pathPricer() const {
 
+        McProfile::Scope scope(profile_, McProfile::Setup);
+        boost::shared_ptr<path_pricer_type> pricer = payoffPricer();
+        if (importanceSampling_)
+            pricer.reset(new LikelihoodRatioPathPricer(pricer,
+                                                       constantProcess(),
+                                                       calibration_.shift));
+        if (profile_.enabled())
+            pricer.reset(new ProfiledPathPricer(pricer, profile_));
+        return pricer;
+    }
+
+
+    template <class RNG, class S>
+    inline
+    boost::shared_ptr<ConstantBlackScholesProcess>
+    MCEuropeanEngine_2<RNG,S>::constantProcess() const {
+
+        boost::shared_ptr<PlainVanillaPayoff> payoff =
+            boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        boost::shared_ptr<GeneralizedBlackScholesProcess> process =
+            boost::dynamic_pointer_cast<GeneralizedBlackScholesProcess>(
+                this->process_);
+        QL_REQUIRE(process, "Black-Scholes process required");
+
+        return setup_.constantProcess(this->arguments_.exercise->lastDate(),
+                                      payoff->strike());
+    }
+
+
+    template <class RNG, class S>
+    inline
+    boost::shared_ptr<typename MCEuropeanEngine_2<RNG,S>::path_pricer_type>
+    MCEuropeanEngine_2<RNG,S>::payoffPricer() const {
+
         boost::shared_ptr<PlainVanillaPayoff> payoff =
             boost::dynamic_pointer_cast<PlainVanillaPayoff>(
                 this->arguments_.payoff);
         QL_REQUIRE(payoff, "non-plain payoff given");
 
+        // the option type is resolved here once, instead of in each path
+        return dispatchOptionType(
+            payoff->optionType(),
+            detail::EuropeanPathPricerFactory(payoff->strike(), discount()));
+    }
+
+
+    template <class RNG, class S>
+    inline DiscountFactor MCEuropeanEngine_2<RNG,S>::discount() const {
         boost::shared_ptr<GeneralizedBlackScholesProcess> process =
             boost::dynamic_pointer_cast<GeneralizedBlackScholesProcess>(
                 this->process_);
         QL_REQUIRE(process, "Black-Scholes process required");
 
-        return boost::shared_ptr<
-                       typename MCEuropeanEngine_2<RNG,S>::path_pricer_type>(
-          new EuropeanPathPricer_2(
-              payoff->optionType(),
-              payoff->strike(),
-              process->riskFreeRate()->discount(this->timeGrid().back())));
+        return process->riskFreeRate()->discount(this->timeGrid().back());
+    }
+
+
+    template <class RNG, class S>
+    inline McCheckpointKey MCEuropeanEngine_2<RNG,S>::checkpointKey() const {
+        boost::shared_ptr<PlainVanillaPayoff> payoff =
+            boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        McCheckpointKey key("MCEuropeanEngine_2");
+        key.add<const void*>(this->process_.get());
+        key.add<BigNatural>(this->seed_);
+        key.add<bool>(this->brownianBridge_);
+        key.add<bool>(this->antitheticVariate_);
+        key.add<bool>(constantParameters_);
+        key.add<bool>(fusedSimulation());
+        key.add(this->timeGrid());
+        key.add<int>(payoff->optionType());
+        key.add<Real>(payoff->strike());
+        return key;
+    }
+
+
+    template <class RNG, class S>
+    inline void MCEuropeanEngine_2<RNG,S>::calculateFromCheckpoint() const {
+        typedef ModelSimulation<RNG,S> simulation_type;
+        Size reusedSamples;
+        const simulation_type& simulation =
+            extendSimulation<simulation_type>(
+                *checkpoint_, checkpointKey(), this->process_,
+                [this]() {
+                    // a new generator, since the one in the set-up
+                    // cache is reset by later calculations
+                    TimeGrid grid = this->timeGrid();
+                    typename RNG::rsg_type rsg =
+                        RNG::make_sequence_generator(grid.size()-1,
+                                                     this->seed_);
+                    return simulation_type(
+                        boost::make_shared<
+                            typename simulation_type::model_type>(
+                                boost::make_shared<path_generator_type>(
+                                    simulatedProcess(), grid, rsg,
+                                    this->brownianBridge_),
+                                this->pathPricer(), S(),
+                                this->antitheticVariate_));
+                },
+                this->requiredTolerance_, this->requiredSamples_,
+                this->maxSamples_, reusedSamples);
+        this->mcModel_ = simulation.model();
+        this->results_.value = this->mcModel_->sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate =
+                this->mcModel_->sampleAccumulator().errorEstimate();
+        this->results_.additionalResults["reusedSamples"] = reusedSamples;
+    }
+
+
+    template <class RNG, class S>
+    inline void
+    MCEuropeanEngine_2<RNG,S>::calculateCurveSensitivities() const {
+        boost::shared_ptr<PlainVanillaPayoff> payoff =
+            boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        boost::shared_ptr<GeneralizedBlackScholesProcess> process =
+            boost::dynamic_pointer_cast<GeneralizedBlackScholesProcess>(
+                this->process_);
+        QL_REQUIRE(process, "Black-Scholes process required");
+
+        boost::shared_ptr<CurveAdjointPathPricer> pricer =
+            dispatchOptionType(
+                payoff->optionType(),
+                detail::EuropeanAdjointPathPricerFactory(process,
+                                                         this->timeGrid(),
+                                                         payoff->strike()));
+        this->mcModel_ =
+            boost::make_shared<MonteCarloModel<SingleVariate,RNG,S> >(
+                pathGenerator(), pricer, S(), this->antitheticVariate_);
+        ModelSimulation<RNG,S> simulation(this->mcModel_);
+        simulateToTarget(simulation, this->requiredTolerance_,
+                         this->requiredSamples_, this->maxSamples_);
+
+        this->results_.value = this->mcModel_->sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate =
+                this->mcModel_->sampleAccumulator().errorEstimate();
+        storeCurveSensitivities(*pricer, *process, volatilityNodes_,
+                                this->results_);
+    }
+
+
+    template <class RNG, class S>
+    inline bool MCEuropeanEngine_2<RNG,S>::fusedSimulation() const {
+        return fusedKernel_ && constantParameters_ && !importanceSampling_ &&
+               !shard_.active() && !sampling_.active();
+    }
+
+
+    template <class RNG, class S>
+    inline Size MCEuropeanEngine_2<RNG,S>::calculateFused() const {
+        boost::shared_ptr<PlainVanillaPayoff> payoff =
+            boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+        QL_REQUIRE(payoff, "non-plain payoff given");
+
+        if (checkpoint_)
+            return dispatchOptionType(payoff->optionType(),
+                                      FusedCalculation(this));
+
+        EuropeanKernelParameters option;
+        option.type = payoff->optionType();
+        option.strike = payoff->strike();
+        option.maturity = this->timeGrid().back();
+        McKernelResult result =
+            mcEuropeanKernel<RNG,S>(blackScholesParameters(*constantProcess()),
+                                    option, kernelSettings());
+        this->results_.value = result.value;
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate = result.errorEstimate;
+        return result.samples;
+    }
+
+
+    template <class RNG, class S>
+    inline McKernelSettings MCEuropeanEngine_2<RNG,S>::kernelSettings() const {
+        McKernelSettings settings;
+        settings.timeSteps = this->timeGrid().size() - 1;
+        settings.requiredSamples = this->requiredSamples_;
+        settings.requiredTolerance = this->requiredTolerance_;
+        settings.maxSamples = this->maxSamples_;
+        settings.seed = this->seed_;
+        settings.antitheticVariate = this->antitheticVariate_;
+        settings.brownianBridge = this->brownianBridge_;
+        return settings;
+    }
+
+
+    template <class RNG, class S>
+    template <Option::Type Type>
+    inline Size MCEuropeanEngine_2<RNG,S>::typedFusedCalculation() const {
+        boost::shared_ptr<PlainVanillaPayoff> payoff =
+            boost::dynamic_pointer_cast<PlainVanillaPayoff>(
+                this->arguments_.payoff);
+
+        // the same simulation run by mcEuropeanKernel, kept in the checkpoint
+        typedef FusedPathSimulation<RNG,EuropeanStepPricer<Type>,S>
+            simulation_type;
+        Size reusedSamples;
+        const simulation_type& simulation =
+            extendSimulation<simulation_type>(
+                *checkpoint_, checkpointKey(), this->process_,
+                [&]() {
+                    boost::shared_ptr<ConstantBlackScholesProcess> process =
+                        constantProcess();
+                    TimeGrid grid = this->timeGrid();
+                    return simulation_type(
+                        process, grid,
+                        EuropeanStepPricer<Type>(
+                            payoff->strike(),
+                            process->discount(grid.back())),
+                        this->brownianBridge_, this->antitheticVariate_,
+                        this->seed_);
+                },
+                this->requiredTolerance_, this->requiredSamples_,
+                this->maxSamples_, reusedSamples);
+        this->results_.value = simulation.sampleAccumulator().mean();
+        if (RNG::allowsErrorEstimate)
+            this->results_.errorEstimate =
+                simulation.sampleAccumulator().errorEstimate();
+        this->results_.additionalResults["reusedSamples"] = reusedSamples;
+        return simulation.samples();
+    }
+
+
+    template <class RNG, class S>
+    inline McKernelResult mcEuropeanKernel(
+                                     const BlackScholesParameters& market,
+                                     const EuropeanKernelParameters& option,
+                                     const McKernelSettings& settings) {
+        QL_REQUIRE(option.strike != Null<Real>() && option.strike >= 0.0,
+                   "non-negative strike required");
+        boost::shared_ptr<ConstantBlackScholesProcess> process =
+            detail::kernelProcess(market);
+        TimeGrid grid = detail::kernelTimeGrid(option.maturity, settings);
+        return dispatchOptionType(
+            option.type,
+            detail::EuropeanKernelCalculation<RNG,S>(process, grid,
+                                                     option.strike,
+                                                     settings));
     }
 
 
@@ -160,7 +855,10 @@ namespace QuantLib {
     : process_(process), antithetic_(false),
       steps_(Null<Size>()), stepsPerYear_(Null<Size>()),
       samples_(Null<Size>()), maxSamples_(Null<Size>()),
-      tolerance_(Null<Real>()), brownianBridge_(false), seed_(0) {}
+      tolerance_(Null<Real>()), brownianBridge_(false), seed_(0),
+      constantParameters_(false), importanceSampling_(false),
+      pilotSamples_(10000), profiling_(false), fusedKernel_(true),
+      curveSensitivities_(false) {}
 
     template <class RNG, class S>
     inline MakeMCEuropeanEngine_2<RNG,S>&
@@ -228,6 +926,77 @@ namespace QuantLib {
     template <class RNG, class S>
     inline MakeMCEuropeanEngine_2<RNG,S>&
     MakeMCEuropeanEngine_2<RNG,S>::withConstantParameters(bool b) {
+        constantParameters_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withImportanceSampling(bool b) {
+        importanceSampling_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withPilotSamples(Size samples) {
+        pilotSamples_ = samples;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withShard(Size firstSample,
+                                             Size endSample,
+                                             Size blockSize) {
+        shard_ = ShardRange(firstSample, endSample, blockSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withProfiling(bool b) {
+        profiling_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withStratifiedSampling(Size strata) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::Stratified, strata);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withMomentMatching(Size batchSize) {
+        QL_REQUIRE(!sampling_.active(), "sampling scheme already set");
+        sampling_ = SamplingScheme(SamplingScheme::MomentMatched, batchSize);
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withFusedKernel(bool b) {
+        fusedKernel_ = b;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withCheckpoint(
+                           const boost::shared_ptr<McCheckpoint>& checkpoint) {
+        checkpoint_ = checkpoint;
+        return *this;
+    }
+
+    template <class RNG, class S>
+    inline MakeMCEuropeanEngine_2<RNG,S>&
+    MakeMCEuropeanEngine_2<RNG,S>::withCurveSensitivities(
+                                   const std::vector<Date>& volatilityNodes) {
+        curveSensitivities_ = true;
+        volatilityNodes_ = volatilityNodes;
         return *this;
     }
 
@@ -247,24 +1016,72 @@ namespace QuantLib {
                                       antithetic_,
                                       samples_, tolerance_,
                                       maxSamples_,
-                                      seed_));
+                                      seed_,
+                                      constantParameters_,
+                                      importanceSampling_,
+                                      pilotSamples_,
+                                      shard_,
+                                      profiling_,
+                                      sampling_,
+                                      fusedKernel_,
+                                      checkpoint_,
+                                      curveSensitivities_,
+                                      volatilityNodes_));
     }
 
 
 
-    inline EuropeanPathPricer_2::EuropeanPathPricer_2(Option::Type type,
+    template <Option::Type Type>
+    inline EuropeanPathPricer_2<Type>::EuropeanPathPricer_2(
                                                       Real strike,
                                                       DiscountFactor discount)
-    : payoff_(type, strike), discount_(discount) {
+    : payoff_(strike), discount_(discount) {
         QL_REQUIRE(strike>=0.0,
                    "strike less than zero not allowed");
     }
 
-    inline Real EuropeanPathPricer_2::operator()(const Path& path) const {
+    template <Option::Type Type>
+    inline Real EuropeanPathPricer_2<Type>::operator()(const Path& path) const {
         QL_REQUIRE(path.length() > 0, "the path cannot be empty");
         return payoff_(path.back()) * discount_;
     }
 
+
+    template <Option::Type Type>
+    inline EuropeanAdjointPathPricer<Type>::EuropeanAdjointPathPricer(
+             const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+             const TimeGrid& grid,
+             Real strike)
+    : CurveAdjointPathPricer(process, grid, grid.back()), payoff_(strike) {
+        QL_REQUIRE(strike>=0.0,
+                   "strike less than zero not allowed");
+    }
+
+
+    template <Option::Type Type>
+    inline EuropeanStepPricer<Type>::EuropeanStepPricer(
+                                                      Real strike,
+                                                      DiscountFactor discount)
+    : payoff_(strike), discount_(discount) {
+        QL_REQUIRE(strike>=0.0,
+                   "strike less than zero not allowed");
+    }
+
+
+    #ifndef QL_MC_ENGINES_HEADER_ONLY
+    // explicitly instantiated in mcengines.cpp
+    extern template class MCEuropeanEngine_2<PseudoRandom,Statistics>;
+    extern template class MakeMCEuropeanEngine_2<PseudoRandom,Statistics>;
+    extern template class MCEuropeanEngine_2<LowDiscrepancy,Statistics>;
+    extern template class MakeMCEuropeanEngine_2<LowDiscrepancy,Statistics>;
+    extern template McKernelResult mcEuropeanKernel<PseudoRandom,Statistics>(
+        const BlackScholesParameters&, const EuropeanKernelParameters&,
+        const McKernelSettings&);
+    extern template McKernelResult mcEuropeanKernel<LowDiscrepancy,Statistics>(
+        const BlackScholesParameters&, const EuropeanKernelParameters&,
+        const McKernelSettings&);
+    #endif
+
 }
 
 
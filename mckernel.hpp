@@ -0,0 +1,122 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file mckernel.hpp
+    \brief Common types for the stateless Monte Carlo pricing kernels
+*/
+
+#ifndef mc_kernel_hpp
+#define mc_kernel_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include <ql/timegrid.hpp>
+#include <ql/utilities/null.hpp>
+
+namespace QuantLib {
+
+    /*! \defgroup mckernels Monte Carlo pricing kernels
+
+        A pricing kernel is a function taking the market, the contract
+        and the simulation settings as plain structs and returning the
+        price; there is one for each of the _2 engines, next to it
+        (see mcEuropeanKernel(), mcAverageStrikeAsianKernel() and
+        mcBarrierKernel()), and the engine delegates to it when
+        constant parameters and the corresponding simulation are
+        required.
+
+        The kernels keep no state between calls and don't use
+        observers, handles, term structures or the evaluation date;
+        times are year fractions from today.  Each call builds and
+        owns its process, grid, generator and accumulator, so that the
+        kernels can be called concurrently from any number of threads
+        without locking.  The one shared resource is the SeedGenerator
+        singleton, which is used when the seed is null; concurrent
+        callers should pass an explicit seed.
+    */
+
+    //! Black-Scholes market with constant parameters
+    /*! \ingroup mckernels */
+    struct BlackScholesParameters {
+        Real spot = Null<Real>();
+        //! continuously-compounded risk-free rate
+        Rate riskFreeRate = 0.0;
+        //! continuously-compounded dividend yield
+        Rate dividendYield = 0.0;
+        Volatility volatility = Null<Volatility>();
+    };
+
+    //! settings of a Monte Carlo pricing kernel
+    /*! Either the number of samples or the tolerance must be given,
+        as for the engines.  The number of steps is not used by
+        kernels simulating on the fixing dates.
+
+        \ingroup mckernels
+    */
+    struct McKernelSettings {
+        Size timeSteps = 1;
+        Size requiredSamples = Null<Size>();
+        Real requiredTolerance = Null<Real>();
+        Size maxSamples = Null<Size>();
+        BigNatural seed = 0;
+        bool antitheticVariate = false;
+        bool brownianBridge = false;
+    };
+
+    //! results of a Monte Carlo pricing kernel
+    /*! \ingroup mckernels */
+    struct McKernelResult {
+        Real value = Null<Real>();
+        //! null if the random-number policy doesn't allow an estimate
+        Real errorEstimate = Null<Real>();
+        Size samples = 0;
+    };
+
+
+    //! the parameters of the given process
+    /*! \ingroup mckernels */
+    inline BlackScholesParameters blackScholesParameters(
+                                   const ConstantBlackScholesProcess& process) {
+        BlackScholesParameters market;
+        market.spot = process.x0();
+        market.riskFreeRate = process.riskFreeRate();
+        market.dividendYield = process.dividendYield();
+        market.volatility = process.volatility();
+        return market;
+    }
+
+
+    namespace detail {
+
+        inline ext::shared_ptr<ConstantBlackScholesProcess> kernelProcess(
+                                         const BlackScholesParameters& market) {
+            QL_REQUIRE(market.spot != Null<Real>() && market.spot > 0.0,
+                       "positive spot required");
+            QL_REQUIRE(market.volatility != Null<Volatility>(),
+                       "volatility not given");
+            return ext::make_shared<ConstantBlackScholesProcess>(
+                market.spot, market.riskFreeRate, market.dividendYield,
+                market.volatility);
+        }
+
+        inline TimeGrid kernelTimeGrid(Time maturity,
+                                       const McKernelSettings& settings) {
+            QL_REQUIRE(maturity > 0.0, "positive maturity required");
+            QL_REQUIRE(settings.timeSteps > 0, "null number of steps");
+            return TimeGrid(maturity, settings.timeSteps);
+        }
+
+        template <class RNG, class Stats>
+        McKernelResult kernelResult(const Stats& accumulator) {
+            McKernelResult result;
+            result.value = accumulator.mean();
+            if (RNG::allowsErrorEstimate)
+                result.errorEstimate = accumulator.errorEstimate();
+            result.samples = accumulator.samples();
+            return result;
+        }
+
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,280 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file mcprofile.hpp
+    \brief Per-phase timing of Monte Carlo engines
+*/
+
+#ifndef mc_profile_hpp
+#define mc_profile_hpp
+
+#include <ql/methods/montecarlo/path.hpp>
+#include <ql/methods/montecarlo/pathpricer.hpp>
+#include <ql/utilities/null.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace QuantLib {
+
+    //! Per-phase timing of a calculation
+    /*! Phases are timed by Scope objects; phases can be nested, and
+        the time recorded for each phase excludes the time spent in
+        the phases nested in it, so that the recorded times add up to
+        the total.  The phases are:
+        - \c setup: extraction of the parameters, time grid, discount
+          factors, path generator and pricer;
+        - \c calibration: pilot runs, if any;
+        - \c randomNumbers: generation of the random sequences;
+        - \c pathEvolution: evolution of the underlying along the
+          paths;
+        - \c payoff: evaluation of the payoff on each path;
+        - \c statistics: accumulation of the samples.
+
+        The \c randomNumbers and \c statistics phases are not timed
+        during the simulation but estimated afterwards, and their
+        estimates are subtracted from the \c pathEvolution phase (see
+        estimateSimulationPhases()); the three times are stored as
+        \c profile.*TimeEstimate results to tell them from the ones
+        that are measured.
+
+        When the profile is disabled, a scope only costs a check of
+        the flag; engines don't time per-path operations in this case.
+        When it is enabled, timing the payoff of each path and
+        replaying the generation and accumulation of the samples make
+        the calculation noticeably slower; in the benchmarks, profiled
+        runs take from 20% longer to twice as long, the most for the
+        fast constant-parameter engines, where the replay costs about
+        as much as the simulation.  The replay is excluded from the
+        reported total.
+    */
+    class McProfile {
+      public:
+        enum Phase { Setup, Calibration, RandomNumbers, PathEvolution,
+                     Payoff, Statistics, PhaseCount };
+        typedef std::chrono::steady_clock clock_type;
+        explicit McProfile(bool enabled = false)
+        : enabled_(enabled), overhead_(0.0) {
+            std::fill(times_, times_ + PhaseCount, 0.0);
+        }
+        bool enabled() const { return enabled_; }
+        //! clears the results and starts a new calculation
+        void reset();
+        //! \name Phases
+        //@{
+        void start(Phase phase);
+        void stop();
+        //! moves the given time (in seconds) from a phase to another
+        void reassign(Phase from, Phase to, double time);
+        /*! excludes the given time, spent by the profiling itself,
+            from the running phase and the total
+        */
+        void excludeOverhead(double time);
+        //@}
+        //! sets a counter, e.g., the number of paths
+        void setCount(const std::string& counter, Real value);
+        //! stores the results as \c profile.* additional results
+        template <class Results>
+        void store(Results& results) const;
+
+        //! times the enclosing scope as a phase of the profile
+        class Scope {
+          public:
+            Scope(McProfile& profile, Phase phase)
+            : profile_(profile.enabled() ? &profile : nullptr) {
+                if (profile_ != nullptr)
+                    profile_->start(phase);
+            }
+            ~Scope() {
+                if (profile_ != nullptr)
+                    profile_->stop();
+            }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+          private:
+            McProfile* profile_;
+        };
+      private:
+        struct RunningPhase {
+            Phase phase;
+            clock_type::time_point start;
+            double nested;
+        };
+        static double seconds(clock_type::duration d) {
+            return std::chrono::duration<double>(d).count();
+        }
+        static const char* name(Phase phase);
+        static bool estimated(Phase phase);
+        bool enabled_;
+        clock_type::time_point start_;
+        std::vector<RunningPhase> running_;
+        double times_[PhaseCount];
+        double overhead_;
+        std::map<std::string, Real> counts_;
+    };
+
+
+    //! path pricer recording its calls as the \c payoff phase
+    class ProfiledPathPricer : public PathPricer<Path> {
+      public:
+        ProfiledPathPricer(ext::shared_ptr<PathPricer<Path> > pricer,
+                           McProfile& profile)
+        : pricer_(std::move(pricer)), profile_(profile) {}
+        Real operator()(const Path& path) const override {
+            McProfile::Scope scope(profile_, McProfile::Payoff);
+            return (*pricer_)(path);
+        }
+      private:
+        ext::shared_ptr<PathPricer<Path> > pricer_;
+        McProfile& profile_;
+    };
+
+
+    //! estimates the random-number and statistics phases of a simulation
+    /*! The generation of the random numbers and the accumulation of
+        the samples happen inside the path generator and the Monte
+        Carlo model, where they can't be timed separately without
+        slowing down the simulation.  Instead, this function replays
+        them: it draws as many numbers as the simulation used, i.e.,
+        \c stepsPerPath for each sample, from a new sequence
+        generator of the given dimension, adds as many samples to a
+        new accumulator, and moves the measured times from the
+        \c pathEvolution phase to the \c randomNumbers and
+        \c statistics phases.  The time of the replay itself is
+        excluded from the profile.  It also sets the \c paths and
+        \c steps counters.
+
+        The results are estimates: the replay doesn't apply the
+        Brownian-bridge transform, nor does it use the generators of
+        stratified or moment-matched sampling, whose cost is left in
+        the \c pathEvolution phase; and the cache effects of the
+        interleaved simulation are not reproduced.
+    */
+    template <class RNG, class S>
+    void estimateSimulationPhases(McProfile& profile,
+                                  Size samples,
+                                  Size dimension,
+                                  Real stepsPerPath,
+                                  bool antitheticVariate,
+                                  BigNatural seed) {
+        if (!profile.enabled())
+            return;
+
+        McProfile::clock_type::time_point replayStart =
+            McProfile::clock_type::now();
+
+        typename RNG::rsg_type generator =
+            RNG::make_sequence_generator(dimension, seed);
+        // as many sequences as needed for the numbers actually drawn,
+        // e.g., fewer than the dimension for paths stopped early
+        Size sequences = static_cast<Size>(std::ceil(
+            static_cast<Real>(samples) * stepsPerPath / Real(dimension)));
+        McProfile::clock_type::time_point start =
+            McProfile::clock_type::now();
+        Real check = 0.0;
+        for (Size i=0; i<sequences; i++)
+            check += generator.nextSequence().value[0];
+        McProfile::clock_type::time_point end = McProfile::clock_type::now();
+        profile.reassign(McProfile::PathEvolution, McProfile::RandomNumbers,
+                         std::chrono::duration<double>(end-start).count());
+
+        S accumulator;
+        start = McProfile::clock_type::now();
+        for (Size i=0; i<samples; i++)
+            accumulator.add(check, 1.0);
+        end = McProfile::clock_type::now();
+        profile.reassign(McProfile::PathEvolution, McProfile::Statistics,
+                         std::chrono::duration<double>(end-start).count());
+
+        profile.excludeOverhead(
+            std::chrono::duration<double>(end-replayStart).count());
+
+        Real paths = static_cast<Real>(antitheticVariate ? 2*samples
+                                                         : samples);
+        profile.setCount("paths", paths);
+        profile.setCount("steps", paths*stepsPerPath);
+    }
+
+
+    // inline definitions
+
+    inline void McProfile::reset() {
+        if (!enabled_)
+            return;
+        running_.clear();
+        std::fill(times_, times_ + PhaseCount, 0.0);
+        overhead_ = 0.0;
+        counts_.clear();
+        start_ = clock_type::now();
+    }
+
+    inline const char* McProfile::name(Phase phase) {
+        static const char* names[PhaseCount] = {
+            "setup", "calibration", "randomNumbers", "pathEvolution",
+            "payoff", "statistics"
+        };
+        return names[phase];
+    }
+
+    inline bool McProfile::estimated(Phase phase) {
+        return phase == RandomNumbers || phase == PathEvolution ||
+               phase == Statistics;
+    }
+
+    inline void McProfile::start(Phase phase) {
+        RunningPhase p = { phase, clock_type::now(), 0.0 };
+        running_.push_back(p);
+    }
+
+    inline void McProfile::stop() {
+        QL_REQUIRE(!running_.empty(), "no phase running");
+        double elapsed = seconds(clock_type::now() - running_.back().start);
+        Phase phase = running_.back().phase;
+        times_[phase] += elapsed - running_.back().nested;
+        running_.pop_back();
+        if (!running_.empty())
+            running_.back().nested += elapsed;
+    }
+
+    inline void McProfile::reassign(Phase from, Phase to, double time) {
+        double moved = std::min(std::max(time, 0.0), times_[from]);
+        times_[from] -= moved;
+        times_[to] += moved;
+    }
+
+    inline void McProfile::excludeOverhead(double time) {
+        if (!running_.empty())
+            running_.back().nested += time;
+        overhead_ += time;
+    }
+
+    inline void McProfile::setCount(const std::string& counter, Real value) {
+        if (enabled_)
+            counts_[counter] = value;
+    }
+
+    template <class Results>
+    inline void McProfile::store(Results& results) const {
+        if (!enabled_)
+            return;
+        for (Size i=0; i<PhaseCount; i++) {
+            Phase phase = static_cast<Phase>(i);
+            results.additionalResults[std::string("profile.") + name(phase)
+                                      + (estimated(phase) ? "TimeEstimate"
+                                                          : "Time")] =
+                times_[i];
+        }
+        results.additionalResults["profile.totalTime"] =
+            seconds(clock_type::now() - start_) - overhead_;
+        for (const auto& c : counts_)
+            results.additionalResults["profile." + c.first] = c.second;
+    }
+
+}
+
+
+#endif
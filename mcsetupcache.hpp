@@ -0,0 +1,253 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file mcsetupcache.hpp
+    \brief Set-up objects of Monte Carlo engines kept across calculations
+*/
+
+#ifndef mc_setup_cache_hpp
+#define mc_setup_cache_hpp
+
+#include "constantblackscholesprocess.hpp"
+#include <ql/methods/montecarlo/pathgenerator.hpp>
+#include <ql/patterns/observable.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace QuantLib {
+
+    //! flag raised when any of the observed objects notifies a change
+    class ChangeFlag : public Observer {
+      public:
+        ChangeFlag() : raised_(true) {}
+        bool raised() const { return raised_; }
+        void lower() { raised_ = false; }
+        void update() override { raised_ = true; }
+      private:
+        bool raised_;
+    };
+
+
+    //! Set-up objects of a Monte Carlo engine, kept across calculations
+    /*! An engine is often asked to recalculate after a change (for
+        instance, in the value of the underlying) which leaves most of
+        its set-up unchanged.  This class keeps:
+        - the time grid, rebuilt only when its inputs change;
+        - the discount factors at the grid times, recalculated only
+          when the grid changes or the risk-free curve notifies a
+          change;
+        - the constant process, extracted (or fitted over the given
+          times) again only when the Black-Scholes process notifies a
+          change or when the date, the strike or the times change;
+        - a random-sequence generator in its initial state, rebuilt
+          only when the dimension or the seed change;
+        - a path generator in its initial state.  As long as its
+          process, grid, seed and Brownian-bridge flag don't change,
+          the generator used by the simulation is reset to it by
+          assignment.  When only the process or the grid change (for
+          instance, when the constant process is extracted again
+          after a change of the spot) a new path generator is built
+          around a copy of the cached sequence generator, which is
+          not seeded again.  Generators with a null seed (i.e.,
+          seeded from the clock) are always rebuilt, so that each
+          calculation uses different numbers as before.
+
+        In both cases, the state of the path generator is copied;
+        this allocates a few arrays of the size of the grid for each
+        calculation, which is negligible compared to the simulation.
+    */
+    template <class RNG>
+    class McSetupCache {
+      public:
+        typedef PathGenerator<typename RNG::rsg_type> path_generator_type;
+        explicit McSetupCache(
+                     ext::shared_ptr<GeneralizedBlackScholesProcess> process);
+        //! grid with the given number of steps, or of steps per year
+        const TimeGrid& timeGrid(Time maturity,
+                                 Size timeSteps,
+                                 Size timeStepsPerYear);
+        //! grid with the given times only
+        const TimeGrid& timeGrid(const std::vector<Time>& times);
+        const std::vector<DiscountFactor>& discounts(const TimeGrid& grid);
+        /*! constant process extracted at the given date or, if times
+            are given, fitted over them and paid at the given date.
+        */
+        const ext::shared_ptr<ConstantBlackScholesProcess>&
+        constantProcess(const Date& date,
+                        Real strike,
+                        const std::vector<Time>& fitTimes = {});
+        ext::shared_ptr<path_generator_type>
+        pathGenerator(const ext::shared_ptr<StochasticProcess1D>& process,
+                      const TimeGrid& grid,
+                      BigNatural seed,
+                      bool brownianBridge);
+      private:
+        static bool sameTimes(const TimeGrid& grid,
+                              const std::vector<Time>& times);
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        // grid
+        TimeGrid grid_;
+        Time maturity_;
+        Size timeSteps_, timeStepsPerYear_;
+        std::vector<Time> mandatoryTimes_;
+        // discounts
+        ChangeFlag curveChanged_;
+        std::vector<Time> discountTimes_;
+        std::vector<DiscountFactor> discounts_;
+        // constant process
+        ChangeFlag processChanged_;
+        Date date_;
+        Real strike_;
+        std::vector<Time> fitTimes_;
+        ext::shared_ptr<ConstantBlackScholesProcess> constantProcess_;
+        // sequence generator
+        Size dimension_;
+        BigNatural seed_;
+        ext::shared_ptr<typename RNG::rsg_type> sequenceGenerator_;
+        // path generator
+        ext::shared_ptr<StochasticProcess1D> generatorProcess_;
+        std::vector<Time> generatorTimes_;
+        bool brownianBridge_;
+        ext::shared_ptr<path_generator_type> initialGenerator_, generator_;
+    };
+
+
+    // template definitions
+
+    template <class RNG>
+    inline McSetupCache<RNG>::McSetupCache(
+                    ext::shared_ptr<GeneralizedBlackScholesProcess> process)
+    : process_(std::move(process)), maturity_(Null<Time>()),
+      timeSteps_(Null<Size>()), timeStepsPerYear_(Null<Size>()),
+      strike_(Null<Real>()), dimension_(0), seed_(0),
+      brownianBridge_(false) {
+        curveChanged_.registerWith(process_->riskFreeRate());
+        processChanged_.registerWith(process_);
+    }
+
+    template <class RNG>
+    inline bool McSetupCache<RNG>::sameTimes(const TimeGrid& grid,
+                                             const std::vector<Time>& times) {
+        return grid.size() == times.size() &&
+            std::equal(times.begin(), times.end(), grid.begin());
+    }
+
+    template <class RNG>
+    inline const TimeGrid& McSetupCache<RNG>::timeGrid(Time maturity,
+                                                       Size timeSteps,
+                                                       Size timeStepsPerYear) {
+        if (grid_.empty() || !mandatoryTimes_.empty() ||
+            maturity != maturity_ || timeSteps != timeSteps_ ||
+            timeStepsPerYear != timeStepsPerYear_) {
+            if (timeSteps != Null<Size>()) {
+                grid_ = TimeGrid(maturity, timeSteps);
+            } else if (timeStepsPerYear != Null<Size>()) {
+                Size steps = static_cast<Size>(timeStepsPerYear*maturity);
+                grid_ = TimeGrid(maturity, std::max<Size>(steps, 1));
+            } else {
+                QL_FAIL("time steps not specified");
+            }
+            maturity_ = maturity;
+            timeSteps_ = timeSteps;
+            timeStepsPerYear_ = timeStepsPerYear;
+            mandatoryTimes_.clear();
+        }
+        return grid_;
+    }
+
+    template <class RNG>
+    inline const TimeGrid&
+    McSetupCache<RNG>::timeGrid(const std::vector<Time>& times) {
+        if (grid_.empty() || times != mandatoryTimes_) {
+            grid_ = TimeGrid(times.begin(), times.end());
+            mandatoryTimes_ = times;
+            maturity_ = Null<Time>();
+        }
+        return grid_;
+    }
+
+    template <class RNG>
+    inline const std::vector<DiscountFactor>&
+    McSetupCache<RNG>::discounts(const TimeGrid& grid) {
+        if (curveChanged_.raised() || !sameTimes(grid, discountTimes_)) {
+            discountTimes_.assign(grid.begin(), grid.end());
+            discounts_.resize(grid.size());
+            for (Size i=0; i<grid.size(); i++)
+                discounts_[i] = process_->riskFreeRate()->discount(grid[i]);
+            curveChanged_.lower();
+        }
+        return discounts_;
+    }
+
+    template <class RNG>
+    inline const ext::shared_ptr<ConstantBlackScholesProcess>&
+    McSetupCache<RNG>::constantProcess(const Date& date,
+                                       Real strike,
+                                       const std::vector<Time>& fitTimes) {
+        if (processChanged_.raised() || !constantProcess_ ||
+            date != date_ || strike != strike_ || fitTimes != fitTimes_) {
+            if (fitTimes.empty())
+                constantProcess_ =
+                    ext::make_shared<ConstantBlackScholesProcess>(
+                        process_, date, strike);
+            else
+                constantProcess_ =
+                    ext::make_shared<ConstantBlackScholesProcess>(
+                        process_, fitTimes, date, strike);
+            date_ = date;
+            strike_ = strike;
+            fitTimes_ = fitTimes;
+            processChanged_.lower();
+        }
+        return constantProcess_;
+    }
+
+    template <class RNG>
+    inline ext::shared_ptr<typename McSetupCache<RNG>::path_generator_type>
+    McSetupCache<RNG>::pathGenerator(
+                         const ext::shared_ptr<StochasticProcess1D>& process,
+                         const TimeGrid& grid,
+                         BigNatural seed,
+                         bool brownianBridge) {
+        if (seed == 0) {
+            typename RNG::rsg_type rsg =
+                RNG::make_sequence_generator(grid.size()-1, seed);
+            return ext::make_shared<path_generator_type>(process, grid, rsg,
+                                                         brownianBridge);
+        }
+
+        bool newSequences = !sequenceGenerator_ ||
+            grid.size()-1 != dimension_ || seed != seed_;
+        if (newSequences) {
+            sequenceGenerator_ = ext::make_shared<typename RNG::rsg_type>(
+                RNG::make_sequence_generator(grid.size()-1, seed));
+            dimension_ = grid.size()-1;
+            seed_ = seed;
+        }
+
+        if (newSequences || !initialGenerator_ ||
+            process != generatorProcess_ ||
+            !sameTimes(grid, generatorTimes_) ||
+            brownianBridge != brownianBridge_) {
+            // the path generator copies the sequence generator in its
+            // initial state
+            initialGenerator_ = ext::make_shared<path_generator_type>(
+                         process, grid, *sequenceGenerator_, brownianBridge);
+            generator_ =
+                ext::make_shared<path_generator_type>(*initialGenerator_);
+            generatorProcess_ = process;
+            generatorTimes_.assign(grid.begin(), grid.end());
+            brownianBridge_ = brownianBridge;
+        } else {
+            // back to the initial state of the random-number generator
+            *generator_ = *initialGenerator_;
+        }
+        return generator_;
+    }
+
+}
+
+
+#endif
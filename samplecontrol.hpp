@@ -0,0 +1,77 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file samplecontrol.hpp
+    \brief Number of samples driven by a target count or tolerance
+*/
+
+#ifndef sample_control_hpp
+#define sample_control_hpp
+
+#include <ql/errors.hpp>
+#include <ql/utilities/null.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace QuantLib {
+
+    //! adds samples until the required number or tolerance is reached
+    /*! The strategy is the same used by McSimulation::calculate().
+        The simulation must provide the following methods:
+        - <tt>void addSamples(Size n)</tt>;
+        - <tt>Size samples() const</tt>, returning the number of
+          samples simulated so far;
+        - <tt>Real errorEstimate() const</tt>, returning the current
+          error estimate.
+    */
+    template <class Simulation>
+    void simulateToTarget(Simulation& simulation,
+                          Real requiredTolerance,
+                          Size requiredSamples,
+                          Size maxSamples) {
+        QL_REQUIRE(requiredTolerance != Null<Real>() ||
+                   requiredSamples != Null<Size>(),
+                   "neither tolerance nor number of samples set");
+
+        if (requiredTolerance == Null<Real>()) {
+            Size sampleNumber = simulation.samples();
+            QL_REQUIRE(requiredSamples >= sampleNumber,
+                       "number of already simulated samples (" << sampleNumber
+                       << ") greater than requested samples ("
+                       << requiredSamples << ")");
+            simulation.addSamples(requiredSamples - sampleNumber);
+            return;
+        }
+
+        const Size minSamples = 1023;
+        if (maxSamples == Null<Size>())
+            maxSamples = std::numeric_limits<Size>::max();
+        Size sampleNumber = simulation.samples();
+        if (sampleNumber < minSamples) {
+            simulation.addSamples(minSamples - sampleNumber);
+            sampleNumber = simulation.samples();
+        }
+        Real error = simulation.errorEstimate();
+        while (error > requiredTolerance) {
+            QL_REQUIRE(sampleNumber < maxSamples,
+                       "max number of samples (" << maxSamples
+                       << ") reached, while error (" << error
+                       << ") is still above tolerance ("
+                       << requiredTolerance << ")");
+            // conservative estimate of how many samples are needed
+            Real order = error*error/requiredTolerance/requiredTolerance;
+            Size nextBatch = Size(std::max<Real>(
+                static_cast<Real>(sampleNumber)*order*0.8 -
+                                      static_cast<Real>(sampleNumber),
+                static_cast<Real>(minSamples)));
+            // do not exceed maxSamples
+            nextBatch = std::min(nextBatch, maxSamples - sampleNumber);
+            sampleNumber += nextBatch;
+            simulation.addSamples(nextBatch);
+            error = simulation.errorEstimate();
+        }
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,368 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file shardedsimulation.hpp
+    \brief Simulation of a range of samples with a mergeable state
+*/
+
+#ifndef sharded_simulation_hpp
+#define sharded_simulation_hpp
+
+#include <ql/errors.hpp>
+#include <ql/methods/montecarlo/mctraits.hpp>
+#include <ql/methods/montecarlo/montecarlomodel.hpp>
+#include <ql/types.hpp>
+#include <ql/utilities/null.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace QuantLib {
+
+    //! mergeable sample accumulator
+    /*! Keeps the number of samples, their weighted mean and the
+        weighted sum of their squared deviations from the mean, which
+        are updated as in West's algorithm.  Two states can be merged
+        exactly as if the samples of the second had been added after
+        those of the first, up to rounding; the result of a sequence
+        of merges only depends on the order in which they are done.
+
+        It provides the part of the Statistics interface used by the
+        Monte Carlo models and simulations in this project, so that it
+        can be used as their accumulator.
+    */
+    class AccumulatorState {
+      public:
+        AccumulatorState() : samples_(0), weightSum_(0.0), mean_(0.0),
+                             squaredDeviations_(0.0) {}
+        void add(Real value, Real weight = 1.0);
+        //! adds the samples accumulated in the given state
+        void merge(const AccumulatorState& other);
+        Size samples() const { return samples_; }
+        Real weightSum() const { return weightSum_; }
+        Real mean() const;
+        Real variance() const;
+        Real errorEstimate() const;
+      private:
+        friend class ShardState;
+        Size samples_;
+        Real weightSum_, mean_, squaredDeviations_;
+    };
+
+
+    //! range of samples simulated by a shard
+    /*! Samples are grouped in blocks of the given size; the random
+        numbers of each block are drawn from a generator seeded by
+        blockSeed() with the seed of the simulation and the index of
+        the block.  Thus, the samples in the range don't depend on the
+        other shards, and the first sample must be at the start of a
+        block.  A null \c begin means that the simulation is not
+        sharded.
+    */
+    struct ShardRange {
+        static const Size defaultBlockSize = 65536;
+        ShardRange() : begin(Null<Size>()), end(Null<Size>()),
+                       blockSize(defaultBlockSize) {}
+        ShardRange(Size begin, Size end, Size blockSize = defaultBlockSize)
+        : begin(begin), end(end), blockSize(blockSize) {}
+        bool active() const { return begin != Null<Size>(); }
+        Size begin, end, blockSize;
+    };
+
+
+    namespace detail {
+
+        // bijective 64-bit finalizer of MurmurHash3
+        inline std::uint64_t fmix64(std::uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+    }
+
+    //! seed of the generator for the given block of samples
+    /*! All the bits of the seed of the simulation and of the index of
+        the block are mixed separately before being combined, so that
+        the blocks of a simulation have different seeds and
+        simulations with different seeds (adjacent ones, or ones
+        differing only in their high bits) don't share block streams
+        shifted by a block.  The result is folded to 32 bits, which
+        is what the Mersenne-twister generator uses of its seed.
+    */
+    inline BigNatural blockSeed(BigNatural seed, Size block) {
+        std::uint64_t h = detail::fmix64(
+            detail::fmix64(static_cast<std::uint64_t>(seed)) ^
+            (static_cast<std::uint64_t>(block) * 0x9e3779b97f4a7c15ULL));
+        std::uint32_t folded = static_cast<std::uint32_t>(h ^ (h >> 32));
+        // a null seed would be replaced by one taken from the clock
+        return folded != 0 ? folded : 0x9e3779b9U;
+    }
+
+
+    //! accumulated state of a shard, one accumulator per block
+    /*! The states of the shards of a simulation can be serialized,
+        collected and merged by mergeShards().  The total is obtained
+        by merging the block accumulators in order, starting from the
+        first; therefore, it doesn't depend on how the samples were
+        split among shards, and merging the shards yields exactly the
+        result of a single shard simulating all the samples.
+    */
+    class ShardState {
+      public:
+        ShardState() : seed_(0), blockSize_(0), begin_(0), end_(0) {}
+        ShardState(BigNatural seed, const ShardRange& range);
+        BigNatural seed() const { return seed_; }
+        Size blockSize() const { return blockSize_; }
+        Size begin() const { return begin_; }
+        Size end() const { return end_; }
+        //! index of the first block
+        Size firstBlock() const { return begin_ / blockSize_; }
+        //! number of samples in the given block, counted from the first
+        Size blockSamples(Size i) const;
+        std::vector<AccumulatorState>& blocks() { return blocks_; }
+        const std::vector<AccumulatorState>& blocks() const {
+            return blocks_;
+        }
+        //! accumulator for all the samples of the shard
+        AccumulatorState total() const;
+        //! \name Serialization
+        /*! The binary format uses the native representation of
+            integers and doubles; the blobs can be exchanged between
+            processes on machines with the same architecture.
+        */
+        //@{
+        std::string serialize() const;
+        static ShardState deserialize(const std::string& blob);
+        //@}
+      private:
+        friend ShardState mergeShards(std::vector<ShardState> shards);
+        BigNatural seed_;
+        Size blockSize_, begin_, end_;
+        std::vector<AccumulatorState> blocks_;
+    };
+
+
+    //! merges the states of contiguous shards of the same simulation
+    ShardState mergeShards(std::vector<ShardState> shards);
+
+
+    //! simulates the blocks of a shard
+    /*! For each block, <tt>simulateBlock(seed, samples)</tt> must
+        return an AccumulatorState containing the given number of
+        samples drawn with a generator built with the given seed.
+    */
+    template <class F>
+    ShardState simulateShard(BigNatural seed,
+                             const ShardRange& range,
+                             const F& simulateBlock) {
+        QL_REQUIRE(seed != 0, "sharded simulations require a fixed seed");
+        ShardState state(seed, range);
+        for (Size i=0; i<state.blocks().size(); i++) {
+            state.blocks()[i] =
+                simulateBlock(blockSeed(seed, state.firstBlock()+i),
+                              state.blockSamples(i));
+        }
+        return state;
+    }
+
+
+    //! simulates the given number of paths for a block
+    template <class RNG>
+    AccumulatorState simulatePaths(
+         const ext::shared_ptr<typename MonteCarloModel<
+             SingleVariate,RNG,AccumulatorState>::path_generator_type>& generator,
+         const ext::shared_ptr<typename MonteCarloModel<
+             SingleVariate,RNG,AccumulatorState>::path_pricer_type>& pricer,
+         bool antitheticVariate,
+         Size samples) {
+        MonteCarloModel<SingleVariate,RNG,AccumulatorState> model(
+            generator, pricer, AccumulatorState(), antitheticVariate);
+        model.addSamples(samples);
+        return model.sampleAccumulator();
+    }
+
+
+    //! stores the value and the state of a shard in the engine results
+    /*! The serialized state is stored as the \c shardState additional
+        result, as a \c std::string.
+    */
+    template <class Results>
+    void storeShardResults(const ShardState& state, Results& results) {
+        AccumulatorState total = state.total();
+        results.value = total.mean();
+        if (total.samples() > 1)
+            results.errorEstimate = total.errorEstimate();
+        results.additionalResults["shardState"] = state.serialize();
+    }
+
+
+    // inline definitions
+
+    inline void AccumulatorState::add(Real value, Real weight) {
+        QL_REQUIRE(weight >= 0.0, "negative weight not allowed");
+        samples_++;
+        weightSum_ += weight;
+        if (weightSum_ == 0.0)
+            return;
+        Real delta = value - mean_;
+        mean_ += delta * weight / weightSum_;
+        squaredDeviations_ += weight * delta * (value - mean_);
+    }
+
+    inline void AccumulatorState::merge(const AccumulatorState& other) {
+        if (other.samples_ == 0)
+            return;
+        if (samples_ == 0) {
+            *this = other;
+            return;
+        }
+        Real weightSum = weightSum_ + other.weightSum_;
+        Real delta = other.mean_ - mean_;
+        if (weightSum > 0.0) {
+            mean_ += delta * other.weightSum_ / weightSum;
+            squaredDeviations_ += other.squaredDeviations_ +
+                delta * delta * weightSum_ * other.weightSum_ / weightSum;
+        }
+        samples_ += other.samples_;
+        weightSum_ = weightSum;
+    }
+
+    inline Real AccumulatorState::mean() const {
+        QL_REQUIRE(weightSum_ > 0.0, "no samples accumulated");
+        return mean_;
+    }
+
+    inline Real AccumulatorState::variance() const {
+        QL_REQUIRE(weightSum_ > 0.0, "no samples accumulated");
+        QL_REQUIRE(samples_ > 1, "at least two samples required");
+        Real n = static_cast<Real>(samples_);
+        return n/(n-1.0) * squaredDeviations_/weightSum_;
+    }
+
+    inline Real AccumulatorState::errorEstimate() const {
+        return std::sqrt(variance()/static_cast<Real>(samples_));
+    }
+
+
+    inline ShardState::ShardState(BigNatural seed, const ShardRange& range)
+    : seed_(seed), blockSize_(range.blockSize), begin_(range.begin),
+      end_(range.end) {
+        QL_REQUIRE(range.active(), "no shard range given");
+        QL_REQUIRE(blockSize_ > 0, "null block size");
+        QL_REQUIRE(begin_ < end_,
+                   "empty shard [" << begin_ << ", " << end_ << ")");
+        QL_REQUIRE(begin_ % blockSize_ == 0,
+                   "first sample of the shard (" << begin_
+                   << ") not at the start of a block of "
+                   << blockSize_ << " samples");
+        blocks_.resize((end_ - begin_ + blockSize_ - 1) / blockSize_);
+    }
+
+    inline Size ShardState::blockSamples(Size i) const {
+        Size first = begin_ + i*blockSize_;
+        return std::min(blockSize_, end_ - first);
+    }
+
+    inline AccumulatorState ShardState::total() const {
+        AccumulatorState result;
+        for (const AccumulatorState& block : blocks_)
+            result.merge(block);
+        return result;
+    }
+
+    namespace detail {
+
+        const char shardStateTag[4] = { 'M', 'C', 'S', '1' };
+
+        template <class T>
+        inline void writeBinary(std::string& blob, T value) {
+            char buffer[sizeof(T)];
+            std::memcpy(buffer, &value, sizeof(T));
+            blob.append(buffer, sizeof(T));
+        }
+
+        template <class T>
+        inline T readBinary(const std::string& blob, Size& position) {
+            QL_REQUIRE(position + sizeof(T) <= blob.size(),
+                       "truncated shard state");
+            T value;
+            std::memcpy(&value, blob.data() + position, sizeof(T));
+            position += sizeof(T);
+            return value;
+        }
+
+    }
+
+    inline std::string ShardState::serialize() const {
+        std::string blob(detail::shardStateTag, 4);
+        detail::writeBinary<std::uint64_t>(blob, seed_);
+        detail::writeBinary<std::uint64_t>(blob, blockSize_);
+        detail::writeBinary<std::uint64_t>(blob, begin_);
+        detail::writeBinary<std::uint64_t>(blob, end_);
+        for (const AccumulatorState& block : blocks_) {
+            detail::writeBinary<std::uint64_t>(blob, block.samples_);
+            detail::writeBinary<double>(blob, block.weightSum_);
+            detail::writeBinary<double>(blob, block.mean_);
+            detail::writeBinary<double>(blob, block.squaredDeviations_);
+        }
+        return blob;
+    }
+
+    inline ShardState ShardState::deserialize(const std::string& blob) {
+        QL_REQUIRE(blob.size() >= 4 &&
+                   std::equal(detail::shardStateTag,
+                              detail::shardStateTag + 4, blob.begin()),
+                   "not a shard state");
+        Size position = 4;
+        BigNatural seed = detail::readBinary<std::uint64_t>(blob, position);
+        Size blockSize = detail::readBinary<std::uint64_t>(blob, position);
+        Size begin = detail::readBinary<std::uint64_t>(blob, position);
+        Size end = detail::readBinary<std::uint64_t>(blob, position);
+        ShardState state(seed, ShardRange(begin, end, blockSize));
+        for (AccumulatorState& block : state.blocks_) {
+            block.samples_ = detail::readBinary<std::uint64_t>(blob, position);
+            block.weightSum_ = detail::readBinary<double>(blob, position);
+            block.mean_ = detail::readBinary<double>(blob, position);
+            block.squaredDeviations_ =
+                detail::readBinary<double>(blob, position);
+        }
+        QL_REQUIRE(position == blob.size(),
+                   "unexpected data at the end of the shard state");
+        return state;
+    }
+
+
+    inline ShardState mergeShards(std::vector<ShardState> shards) {
+        QL_REQUIRE(!shards.empty(), "no shards given");
+        std::sort(shards.begin(), shards.end(),
+                  [](const ShardState& s1, const ShardState& s2) {
+                      return s1.begin() < s2.begin();
+                  });
+        ShardState result = shards.front();
+        for (Size i=1; i<shards.size(); i++) {
+            const ShardState& shard = shards[i];
+            QL_REQUIRE(shard.seed() == result.seed_ &&
+                       shard.blockSize() == result.blockSize_,
+                       "shards from different simulations given");
+            QL_REQUIRE(shard.begin() == result.end_,
+                       "shards not contiguous: samples from "
+                       << result.end_ << " to " << shard.begin()
+                       << " missing or overlapping");
+            result.blocks_.insert(result.blocks_.end(),
+                                  shard.blocks().begin(),
+                                  shard.blocks().end());
+            result.end_ = shard.end();
+        }
+        return result;
+    }
+
+}
+
+
+#endif
@@ -0,0 +1,138 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file shardlauncher.hpp
+    \brief Local launcher running the shards of a simulation in worker processes
+*/
+
+#ifndef shard_launcher_hpp
+#define shard_launcher_hpp
+
+#include "shardedsimulation.hpp"
+#include <ql/errors.hpp>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#  define QL_SHARD_LAUNCHER_FORK
+#endif
+
+namespace QuantLib {
+
+    //! splits the given number of samples into shards for the workers
+    /*! Each shard starts at the beginning of a block; the blocks are
+        divided as evenly as possible among the workers.
+    */
+    inline std::vector<ShardRange> splitSamples(
+                    Size samples,
+                    Size workers,
+                    Size blockSize = ShardRange::defaultBlockSize) {
+        QL_REQUIRE(samples > 0, "no samples given");
+        QL_REQUIRE(workers > 0, "no workers given");
+        Size blocks = (samples + blockSize - 1) / blockSize;
+        QL_REQUIRE(workers <= blocks,
+                   "more workers (" << workers << ") than blocks ("
+                   << blocks << ") of samples");
+        std::vector<ShardRange> shards;
+        for (Size i=0; i<workers; i++) {
+            Size begin = (i*blocks/workers) * blockSize;
+            Size end = std::min(((i+1)*blocks/workers) * blockSize, samples);
+            shards.push_back(ShardRange(begin, end, blockSize));
+        }
+        return shards;
+    }
+
+
+    //! runs the given task in forked worker processes
+    /*! The task is called in the i-th worker with the index \c i; the
+        string it returns (usually a serialized ShardState) is sent
+        back to the parent through a pipe.  The results are returned
+        in the order of the workers.  If a task throws, the error
+        message is reported by the parent.
+
+        This stands in for a cluster scheduler on a single machine and
+        is only available on POSIX systems.
+
+        \warning the workers are forked from the calling process; it
+                 should not have other threads running.
+    */
+    inline std::vector<std::string> runInWorkers(
+                         Size workers,
+                         const std::function<std::string(Size)>& task) {
+        #ifdef QL_SHARD_LAUNCHER_FORK
+        std::vector<pid_t> pids(workers);
+        std::vector<int> pipes(workers);
+        for (Size i=0; i<workers; i++) {
+            int fd[2];
+            QL_REQUIRE(::pipe(fd) == 0, "could not create pipe");
+            pid_t pid = ::fork();
+            QL_REQUIRE(pid >= 0, "could not fork worker " << i);
+            if (pid == 0) {
+                ::close(fd[0]);
+                std::string result;
+                char status = 0;
+                try {
+                    result = task(i);
+                } catch (std::exception& e) {
+                    result = e.what();
+                    status = 1;
+                } catch (...) {
+                    result = "unknown error";
+                    status = 1;
+                }
+                std::string message = status + result;
+                const char* data = message.data();
+                std::size_t left = message.size();
+                while (left > 0) {
+                    ssize_t written = ::write(fd[1], data, left);
+                    if (written <= 0)
+                        _exit(2);
+                    data += written;
+                    left -= written;
+                }
+                ::close(fd[1]);
+                _exit(0);
+            }
+            ::close(fd[1]);
+            pids[i] = pid;
+            pipes[i] = fd[0];
+        }
+
+        std::vector<std::string> results(workers);
+        std::string errors;
+        for (Size i=0; i<workers; i++) {
+            std::string message;
+            char buffer[65536];
+            ssize_t n;
+            while ((n = ::read(pipes[i], buffer, sizeof(buffer))) > 0)
+                message.append(buffer, n);
+            ::close(pipes[i]);
+            int status;
+            ::waitpid(pids[i], &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+                message.empty()) {
+                errors += "\n  worker " + std::to_string(i) +
+                          " terminated abnormally";
+            } else if (message[0] != 0) {
+                errors += "\n  worker " + std::to_string(i) + ": " +
+                          message.substr(1);
+            } else {
+                results[i] = message.substr(1);
+            }
+        }
+        QL_REQUIRE(errors.empty(), "shard launcher failed:" << errors);
+        return results;
+        #else
+        QL_FAIL("worker processes not available on this platform");
+        #endif
+    }
+
+}
+
+
+#endif
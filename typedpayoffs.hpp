@@ -0,0 +1,115 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*! \file typedpayoffs.hpp
+    \brief Payoffs and barriers with option and barrier type known at compile time
+*/
+
+#ifndef typed_payoffs_hpp
+#define typed_payoffs_hpp
+
+#include <ql/instruments/barriertype.hpp>
+#include <ql/option.hpp>
+#include <algorithm>
+
+namespace QuantLib {
+
+    //! plain-vanilla payoff with the option type fixed at compile time
+    /*! The type is a template parameter, so that the comparison in
+        the payoff is resolved by the compiler instead of being
+        performed on each call, as PlainVanillaPayoff does.
+    */
+    template <Option::Type Type>
+    class TypedVanillaPayoff {
+      public:
+        explicit TypedVanillaPayoff(Real strike) : strike_(strike) {}
+        Real operator()(Real price) const {
+            return Type == Option::Call ? std::max<Real>(price - strike_, 0.0)
+                                        : std::max<Real>(strike_ - price, 0.0);
+        }
+        //! derivative of the payoff with respect to the price
+        Real derivative(Real price) const {
+            if (Type == Option::Call)
+                return price > strike_ ? 1.0 : 0.0;
+            else
+                return price < strike_ ? -1.0 : 0.0;
+        }
+        Real strike() const { return strike_; }
+      private:
+        Real strike_;
+    };
+
+
+    //! properties of a barrier type known at compile time
+    template <Barrier::Type Type>
+    struct BarrierTraits {
+        static const bool up =
+            (Type == Barrier::UpIn || Type == Barrier::UpOut);
+        static const bool knockIn =
+            (Type == Barrier::UpIn || Type == Barrier::DownIn);
+        //! whether the given value is on or past the barrier
+        static bool triggered(Real price, Real barrier) {
+            return up ? price >= barrier : price <= barrier;
+        }
+    };
+
+
+    //! calls <tt>f.template apply<Type>()</tt> for the given option type
+    /*! The functor must define its \c result_type. */
+    template <class F>
+    inline typename F::result_type dispatchOptionType(Option::Type type,
+                                                      const F& f) {
+        switch (type) {
+          case Option::Call:
+            return f.template apply<Option::Call>();
+          case Option::Put:
+            return f.template apply<Option::Put>();
+          default:
+            QL_FAIL("unknown option type");
+        }
+    }
+
+    namespace detail {
+
+        template <Barrier::Type BarrierType, class F>
+        class BoundBarrierType {
+          public:
+            typedef typename F::result_type result_type;
+            explicit BoundBarrierType(const F& f) : f_(f) {}
+            template <Option::Type Type>
+            result_type apply() const {
+                return f_.template apply<BarrierType, Type>();
+            }
+          private:
+            const F& f_;
+        };
+
+    }
+
+    //! calls <tt>f.template apply<BarrierType, Type>()</tt> for the given types
+    /*! The functor must define its \c result_type. */
+    template <class F>
+    inline typename F::result_type dispatchBarrierType(Barrier::Type barrierType,
+                                                       Option::Type type,
+                                                       const F& f) {
+        switch (barrierType) {
+          case Barrier::DownIn:
+            return dispatchOptionType(
+                type, detail::BoundBarrierType<Barrier::DownIn, F>(f));
+          case Barrier::UpIn:
+            return dispatchOptionType(
+                type, detail::BoundBarrierType<Barrier::UpIn, F>(f));
+          case Barrier::DownOut:
+            return dispatchOptionType(
+                type, detail::BoundBarrierType<Barrier::DownOut, F>(f));
+          case Barrier::UpOut:
+            return dispatchOptionType(
+                type, detail::BoundBarrierType<Barrier::UpOut, F>(f));
+          default:
+            QL_FAIL("unknown barrier type");
+        }
+    }
+
+}
+
+
+#endif